@@ -10,7 +10,212 @@
 #include <cassert>
 
 #include <random>
+#include <vector>
+using std::vector;
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <string>
+#include <queue>
+#include <functional>
+#include <stdint.h>
+#include <new>
+#include <system_error>
+#include <unordered_map>
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+#include <chrono>
+
+// xoshiro256** (Blackman & Vigna). Small state which is easy to save and
+// restore. 'longJump' advances it by 2^192 draws and 'jump' by 2^128, so
+// streams obtained by jumping from one seed never overlap: streams of a seed
+// are long jumps apart, and each has room for 2^64 jumps of its own (as
+// taken by block generators drawing from it).
+class Randomizer {
+public:
+  typedef uint64_t result_type;
+
+  static constexpr result_type min() { return 0; }
+  static constexpr result_type max() { return ~static_cast<result_type>(0); }
+
+  explicit Randomizer(uint64_t seed = 0) { this->seed(seed); }
+
+  void seed(uint64_t seed);
+
+  // seed, then move to the k'th non overlapping stream of that seed
+  void seed(uint64_t seed, uint stream) {
+    this->seed(seed);
+    for(uint k = 0; k < stream; ++k) {
+      longJump();
+    }
+  }
+
+  result_type operator()(void) {
+    uint64_t const r = rotl(s[1] * 5, 7) * 9;
+    uint64_t const t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+    return r;
+  }
+
+  void jump(void);
+  void longJump(void);
+
+  // full engine state
+  uint64_t s[4];
+  
+private:
+  void jump(const uint64_t* j);
+  
+  static inline uint64_t rotl(uint64_t const x, int k) {
+    return (x << k) | (x >> (64 - k));
+  }
+};
+
+void
+Randomizer::seed(uint64_t x)
+{
+  // expand seed with splitmix64, never leaves the all zero state
+  for(uint k = 0; k < 4; ++k) {
+    uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    s[k] = z ^ (z >> 31);
+  }
+}
+
+void
+Randomizer::jump(void)
+{
+  static const uint64_t j[] = { 0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL,
+				0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL };
+  jump(j);
+}
+
+void
+Randomizer::longJump(void)
+{
+  static const uint64_t j[] = { 0x76e15d3efefdcbbfULL, 0xc5004e441c522fb3ULL,
+				0x77710069854ee241ULL, 0x39109bb02acbe635ULL };
+  jump(j);
+}
+
+void
+Randomizer::jump(const uint64_t* const j)
+{
+  uint64_t t[4] = {0,0,0,0};
+  for(uint i = 0; i < 4; ++i) {
+    for(uint b = 0; b < 64; ++b) {
+      if( j[i] & (static_cast<uint64_t>(1) << b) ) {
+	for(uint k = 0; k < 4; ++k) {
+	  t[k] ^= s[k];
+	}
+      }
+      (*this)();
+    }
+  }
+  std::copy(t, t+4, s);
+}
+
+// Random values generated in blocks by interleaved xoshiro256** streams.
+// The lanes are independent, so the compiler vectorizes the block loop,
+// and the event loop gets its values from a plain array.
+class RandomBlock {
+public:
+  // Lane l starts at 'rng' jumped l times, and 'rng' is left jumped past
+  // all lanes, so lanes and later draws from 'rng' never overlap.
+  explicit RandomBlock(Randomizer& rng);
+
+  uint64_t operator()(void) {
+    if( pos == blockSize ) {
+      fill();
+    }
+    return block[pos++];
+  }
+
+  // uniform in [0,1)
+  double uniform(void) { return ((*this)() >> 11) * (1.0 / 9007199254740992.0); }
+
+  // uniform in [0,n), the high word of the 128 bit product of a draw and n
+  // (in 32 bit halves, no carry is lost)
+  uint below(uint n) {
+    uint64_t const x = (*this)();
+    uint64_t const lo = (x & 0xffffffffULL) * n;
+    return ((x >> 32) * n + (lo >> 32)) >> 32;
+  }
+  
+  double exponential(double rate) { return -log1p(-uniform()) / rate; }
+  
+private:
+  static uint const nLanes = 4;
+  static uint const blockSize = 256;
+  
+  void fill(void);
+  
+  // lane state, s[i][l] is word i of lane l
+  uint64_t s[4][nLanes];
+  uint64_t block[blockSize];
+  uint	   pos;
+};
+
+RandomBlock::RandomBlock(Randomizer& rng) :
+  pos(blockSize)
+{
+  for(uint l = 0; l < nLanes; ++l) {
+    for(uint i = 0; i < 4; ++i) {
+      s[i][l] = rng.s[i];
+    }
+    rng.jump();
+  }
+}
+
+void
+RandomBlock::fill(void)
+{
+  for(uint k = 0; k < blockSize; k += nLanes) {
+    for(uint l = 0; l < nLanes; ++l) {
+      uint64_t const x = s[1][l] * 5;
+      block[k + l] = ((x << 7) | (x >> 57)) * 9;
+      uint64_t const t = s[1][l] << 17;
+      s[2][l] ^= s[0][l];
+      s[3][l] ^= s[1][l];
+      s[1][l] ^= s[2][l];
+      s[0][l] ^= s[3][l];
+      s[2][l] ^= t;
+      s[3][l] = (s[3][l] << 45) | (s[3][l] >> 19);
+    }
+  }
+  pos = 0;
+}
+
+// Raw binary I/O of checkpoints (native byte order)
+template<typename T>
+static inline bool
+put(FILE* f, T const& x)
+{
+  return fwrite(&x, sizeof(T), 1, f) == 1;
+}
+
+template<typename T>
+static inline bool
+get(FILE* f, T& x)
+{
+  return fread(&x, sizeof(T), 1, f) == 1;
+}
 
+struct PatchTrace;
+
+// Python objects of trace nodes already converted (borrowed references).
+typedef std::unordered_map<const PatchTrace*, PyObject*> PatchTraceObjects;
+
+// Kept small (32 bytes) since a traced run holds millions of those.
 struct PatchTrace {
   PatchTrace(double t, uint pl, uint pt, uint s, PatchTrace* prev);
   
@@ -20,9 +225,10 @@ struct PatchTrace {
   uint	speciesIndex;
   PatchTrace*	prev;
   int	refCount;
-  PyObject* asp;
+  // pass of optTraces that claimed the node, fits in the padding
+  std::atomic<uint> claimedBy;
   
-  PyObject* asPyObject(void);
+  PyObject* asPyObject(PatchTraceObjects& done) const;
 };
 
 
@@ -33,17 +239,18 @@ PatchTrace::PatchTrace(double t, uint pl, uint pt, uint s, PatchTrace* _prev) :
   speciesIndex(s),
   prev(_prev),
   refCount(1),
-  asp(0)
+  claimedBy(0)
 {}
 
 PyObject*
-PatchTrace::asPyObject(void)
+PatchTrace::asPyObject(PatchTraceObjects& done) const
 {
-  if( asp ) {
-    Py_INCREF(asp);
-    return asp;
+  auto const i = done.find(this);
+  if( i != done.end() ) {
+    Py_INCREF(i->second);
+    return i->second;
   }
-  asp = PyTuple_New(4);
+  PyObject* const asp = PyTuple_New(4);
   PyTuple_SET_ITEM(asp, 0, PyFloat_FromDouble(pTime));
   PyObject* u2 = PyTuple_New(2);
   PyTuple_SET_ITEM(u2, 0, PyInt_FromLong(fromPlot));
@@ -52,19 +259,210 @@ PatchTrace::asPyObject(void)
   PyTuple_SET_ITEM(asp, 2, PyInt_FromLong(speciesIndex));
   PyObject* p;
   if( prev ) {
-    p = prev->asPyObject();
+    p = prev->asPyObject(done);
   } else {
     Py_INCREF(Py_None);
     p = Py_None;
   }
   PyTuple_SET_ITEM(asp, 3, p);
+  done[this] = asp;
   return asp;
 }
 
-struct Patch {
-  uint	speciesIndex;
+// Allocates trace nodes from large slabs and recycles freed ones through a
+// free list. A traced run creates and frees a node on every event, and
+// going through malloc/free for each was the bulk of the run time.
+class PatchTracePool {
+public:
+  PatchTracePool() :
+    freeList(0),
+    nUsed(0),
+    peak(0)
+    {}
+  ~PatchTracePool();
+
+  PatchTrace* make(double t, uint pl, uint pt, uint s, PatchTrace* prev) {
+    if( ! freeList ) {
+      grow();
+    }
+    PatchTrace* const n = freeList;
+    freeList = n->prev;
+    if( ++nUsed > peak ) {
+      peak = nUsed;
+    }
+    return new (n) PatchTrace(t, pl, pt, s, prev);
+  }
+
+  void release(PatchTrace* const p) {
+    p->prev = freeList;
+    freeList = p;
+    --nUsed;
+  }
+
+  // Release n nodes chained through prev from head to tail
+  void release(PatchTrace* const head, PatchTrace* const tail, size_t const n) {
+    if( n > 0 ) {
+      tail->prev = freeList;
+      freeList = head;
+      nUsed -= n;
+    }
+  }
+
+  // Number of nodes in use
+  size_t size(void) const { return nUsed; }
+  // Highest number of nodes in use at any one time
+  size_t peakSize(void) const { return peak; }
+  
+private:
+  static uint const slabSize = 1 << 14;
+  
+  void grow(void);
+  
+  vector<PatchTrace*> slabs;
+  PatchTrace*	      freeList;
+  size_t	      nUsed;
+  size_t	      peak;
+};
+
+PatchTracePool::~PatchTracePool()
+{
+  for(auto s = slabs.begin(); s != slabs.end(); ++s) {
+    ::operator delete(*s);
+  }
+}
+
+void
+PatchTracePool::grow(void)
+{
+  PatchTrace* const slab =
+    static_cast<PatchTrace*>(::operator new(slabSize * sizeof(PatchTrace)));
+  slabs.push_back(slab);
+  // chain in reverse, so nodes are handed out in address order
+  for(uint k = slabSize; k > 0; --k) {
+    slab[k-1].prev = freeList;
+    freeList = slab + (k-1);
+  }
+}
+
+// Species abundances of each plot and of the whole community, kept up to
+// date as individuals are replaced, so summaries never need a pass over the
+// community.
+class AbundanceStats {
+public:
+  AbundanceStats(uint nPlots, uint plotSize);
+
+  void add(uint np, uint s) { add(plots[np], sumPairs[np], s); add(all, sumPairs[nPlots], s); }
+  void remove(uint np, uint s) { remove(plots[np], sumPairs[np], s); remove(all, sumPairs[nPlots], s); }
+
+  // Summary of plot np, or of the whole community when np is nPlots.
+  struct Summary {
+    uint   richness;
+    double shannon;
+    // probability two distinct individuals are of the same species
+    double simpson;
+    // k'th is the number of species with abundance in [2^k, 2^(k+1))
+    vector<uint> octaves;
+
+    PyObject* asPyObject(void) const;
+  };
+  
+  void summary(uint np, Summary& sm) const;
+
+  // Summaries of all plots followed by the whole community
+  void summaries(vector<Summary>& sms) const;
+
+  // (time, per plot summaries, community summary) for summaries of all plots
+  // followed by the whole community
+  static PyObject* asPyObject(double t, vector<Summary> const& sms);
+  
+private:
+  typedef std::unordered_map<uint, uint> Counts;
+  
+  static void add(Counts& c, double& sp, uint s) {
+    uint& n = c[s];
+    sp += 2.0 * n;
+    ++n;
+  }
+
+  static void remove(Counts& c, double& sp, uint s) {
+    auto const i = c.find(s);                              assert( i != c.end() );
+    --i->second;
+    sp -= 2.0 * i->second;
+    if( i->second == 0 ) {
+      c.erase(i);
+    }
+  }
+  
+  uint const	nPlots;
+  uint const	plotSize;
+  vector<Counts> plots;
+  Counts	 all;
+  // sum of n(n-1) over species, per plot and the whole community last
+  vector<double> sumPairs;
 };
+
+AbundanceStats::AbundanceStats(uint _nPlots, uint _plotSize) :
+  nPlots(_nPlots),
+  plotSize(_plotSize),
+  plots(_nPlots),
+  sumPairs(_nPlots + 1, 0.0)
+{}
+
+void
+AbundanceStats::summary(uint np, Summary& sm) const
+{
+  Counts const& c = np < nPlots ? plots[np] : all;
+  double const n = np < nPlots ? plotSize : static_cast<double>(plotSize) * nPlots;
   
+  double h = 0;
+  sm.octaves.clear();
+  for(auto i = c.begin(); i != c.end(); ++i) {
+    double const p = i->second / n;
+    h -= p * log(p);
+    uint k = 0;
+    while( (i->second >> (k+1)) != 0 ) {
+      ++k;
+    }
+    if( k >= sm.octaves.size() ) {
+      sm.octaves.resize(k+1, 0);
+    }
+    ++sm.octaves[k];
+  }
+  sm.richness = c.size();
+  sm.shannon = h;
+  sm.simpson = n > 1 ? sumPairs[np] / (n * (n-1)) : 1.0;
+}
+
+void
+AbundanceStats::summaries(vector<Summary>& sms) const
+{
+  sms.resize(nPlots + 1);
+  for(uint np = 0; np <= nPlots; ++np) {
+    summary(np, sms[np]);
+  }
+}
+
+PyObject*
+AbundanceStats::Summary::asPyObject(void) const
+{
+  PyObject* o = PyTuple_New(octaves.size());
+  for(uint k = 0; k < octaves.size(); ++k) {
+    PyTuple_SET_ITEM(o, k, PyInt_FromLong(octaves[k]));
+  }
+  return Py_BuildValue("IddN", richness, shannon, simpson, o);
+}
+
+PyObject*
+AbundanceStats::asPyObject(double t, vector<Summary> const& sms)
+{
+  uint const nPlots = sms.size() - 1;
+  PyObject* p = PyTuple_New(nPlots);
+  for(uint np = 0; np < nPlots; ++np) {
+    PyTuple_SET_ITEM(p, np, sms[np].asPyObject());
+  }
+  return Py_BuildValue("dNN", t, p, sms[nPlots].asPyObject());
+}
+
 class MetaCommunity {
 public:
   MetaCommunity(uint nPlots, uint plotSize, double timeStamp = 0);
@@ -77,54 +475,218 @@ public:
   void setTime(double t) { timeStamp = t; }
   unsigned long nIndividuals(void) const { return nPlots * plotSize; }
 
-  Patch& get(uint np, uint ni) { return community[np][ni]; }
-  Patch const& get(uint np, uint ni) const { return community[np][ni]; }
+  // Individuals are numbered plot after plot: ni'th individual of plot np
+  // is individual np*plotSize + ni.
+  uint species(unsigned long k) const { return community[k]; }
+  uint species(uint np, uint ni) const { return community[np * plotSize + ni]; }
 
   PyObject* asPyObject(void) const;
 
+  // Checkpoint of species, time, last species and random state. 'read'
+  // expects a community of the same size as the one written.
+  bool write(FILE* f) const;
+  bool read(FILE* f);
+  
+  // Species array as a (read only) 2D buffer of nPlots x plotSize, kept alive
+  // by 'owner'.
+  void asBuffer(Py_buffer& view, PyObject* owner);
+  
   void setSpecies(uint np, uint ni, uint s);
 
+  // Highest species number ever assigned
   uint getLastSpecies(void) const { return lastSpecies; }
+
+  // Number for a new species. When recycling, the smallest number of an
+  // extinct species, so species numbers stay close to the number of live
+  // species and per species tables can be dense.
+  uint newSpecies(void);
   
-private:
-  Patch** community;
+  void setRecycleSpecies(bool r);
+  bool recyclesSpecies(void) const { return recycle; }
+  
+  // Rebuild species counts from the species array. All numbers up to the
+  // last species which are not in use are then free.
+  void recount(void);
+  
+  // Number of individuals of species s. Counts are kept for every number up
+  // to the last species, so without recycling they grow with the number of
+  // species ever created, not with the number of live ones.
+  uint speciesCount(uint s) const { return s < counts.size() ? counts[s] : 0; }
+  uint nLiveSpecies(void) const { return nLive; }
+  // Highest number of a live species. Events only raise a bound on it, which
+  // is scanned down here, so an event is O(1) and a call is linear in the
+  // numbers it scans past.
+  uint maxLiveSpecies(void) const;
+
+  // Start (or stop) maintaining abundance statistics.
+  void trackAbundance(bool on);
+  const AbundanceStats* getAbundance(void) const { return abundance; }
+
+  // Number of birth/death events simulated so far (not kept in checkpoints)
+  unsigned long long eventsCount(void) const { return nEvents; }
+  void countEvents(unsigned long long n) { nEvents += n; }
+  
+  // Community own random stream. All simulation of the community draws from
+  // it, so runs are reproducible from the seed and independent of each other.
+  Randomizer rng;
+
+  // Number of python calls reading the community, -1 while one changes it
+  // (see CommunityUse)
+  int busy;
+  
+protected:
+  // species of all individuals, in one block
+  uint*   community;
   double  timeStamp;
   uint    lastSpecies;
+  // 0 unless tracked
+  AbundanceStats* abundance;
+  unsigned long long nEvents;
+
+private:
+  void extinct(uint s);
+  
+  // number of individuals of each species
+  vector<uint> counts;
+  uint	       nLive;
+  // no live species above
+  mutable uint maxLive;
+  bool	       recycle;
+  // numbers of extinct species (may hold some revived since), smallest first
+  std::priority_queue<uint, vector<uint>, std::greater<uint> > freeIds;
+  
+  Py_ssize_t shape[2];
+  Py_ssize_t strides[2];
 };
 
 MetaCommunity::MetaCommunity(uint _nPlots, uint _plotSize, double _timeStamp) :
   nPlots(_nPlots),
   plotSize(_plotSize),
+  busy(0),
   timeStamp(_timeStamp),
-  lastSpecies(0)
+  lastSpecies(0),
+  abundance(0),
+  nEvents(0),
+  counts(1, _nPlots * _plotSize),
+  nLive(1),
+  maxLive(0),
+  recycle(false)
 {
-  community = new Patch* [nPlots];
-  for(uint np = 0; np < nPlots; ++np) {
-    community[np] = new Patch [plotSize];
-    for(uint ni = 0; ni < plotSize; ++ni) {
-      Patch& p = community[np][ni];
-      p.speciesIndex = 0;
-    }
-  }
+  community = new uint [nIndividuals()];
+  std::fill(community, community + nIndividuals(), 0);
+
+  shape[0] = nPlots;
+  shape[1] = plotSize;
+  strides[0] = plotSize * sizeof(uint);
+  strides[1] = sizeof(uint);
 }
 
 MetaCommunity::~MetaCommunity()
 {
-   for(uint np = 0; np < nPlots; ++np) {
-     delete [] community[np];
-   }
-   delete [] community;
+  delete abundance;
+  delete [] community;
+}
+
+void
+MetaCommunity::trackAbundance(bool const on)
+{
+  if( on && ! abundance ) {
+    abundance = new AbundanceStats(nPlots, plotSize);
+    for(uint np = 0; np < nPlots; ++np) {
+      for(uint ni = 0; ni < plotSize; ++ni) {
+	abundance->add(np, species(np, ni));
+      }
+    }
+  } else if( ! on ) {
+    delete abundance;
+    abundance = 0;
+  }
 }
 
 inline void
 MetaCommunity::setSpecies(uint np, uint ni, uint s)
 {
-  get(np,ni).speciesIndex = s;
+  uint& x = community[np * plotSize + ni];
+  if( abundance ) {
+    abundance->remove(np, x);
+    abundance->add(np, s);
+  }
+  if( s >= counts.size() ) {
+    counts.resize(s+1, 0);
+  }
+  if( counts[s]++ == 0 ) {
+    ++nLive;
+    if( s > maxLive ) {
+      maxLive = s;
+    }
+  }
+  if( --counts[x] == 0 ) {
+    extinct(x);
+  }
+  x = s;
   if( s > lastSpecies ) {
     lastSpecies = s;
   }
 }
 
+void
+MetaCommunity::extinct(uint const s)
+{
+  --nLive;
+  if( recycle ) {
+    freeIds.push(s);
+  }
+}
+
+uint
+MetaCommunity::maxLiveSpecies(void) const
+{
+  while( maxLive > 0 && counts[maxLive] == 0 ) {
+    --maxLive;
+  }
+  return maxLive;
+}
+
+uint
+MetaCommunity::newSpecies(void)
+{
+  while( ! freeIds.empty() ) {
+    uint const s = freeIds.top();
+    freeIds.pop();
+    if( speciesCount(s) == 0 ) {
+      return s;
+    }
+  }
+  return lastSpecies + 1;
+}
+
+void
+MetaCommunity::setRecycleSpecies(bool const r)
+{
+  recycle = r;
+  recount();
+}
+
+void
+MetaCommunity::recount(void)
+{
+  counts.assign(lastSpecies + 1, 0);
+  for(unsigned long k = 0; k < nIndividuals(); ++k) {
+    ++counts[community[k]];
+  }
+  nLive = 0;
+  maxLive = 0;
+  freeIds = std::priority_queue<uint, vector<uint>, std::greater<uint> >();
+  for(uint s = 0; s <= lastSpecies; ++s) {
+    if( counts[s] > 0 ) {
+      ++nLive;
+      maxLive = s;
+    } else if( recycle ) {
+      freeIds.push(s);
+    }
+  }
+}
+
 PyObject*
 MetaCommunity::asPyObject(void) const
 {
@@ -132,13 +694,60 @@ MetaCommunity::asPyObject(void) const
   for(uint np = 0; np < nPlots; ++np) {
     PyObject* p = PyTuple_New(plotSize);
     for(uint ni = 0; ni < plotSize; ++ni) {
-      PyTuple_SET_ITEM(p, ni, PyInt_FromLong(get(np,ni).speciesIndex));
+      PyTuple_SET_ITEM(p, ni, PyInt_FromLong(species(np,ni)));
     }
     PyTuple_SET_ITEM(o, np, p);
   }
   return o;
 }
 
+bool
+MetaCommunity::write(FILE* const f) const
+{
+  return put(f, timeStamp) && put(f, lastSpecies) &&
+    fwrite(rng.s, sizeof(rng.s), 1, f) == 1 &&
+    fwrite(community, sizeof(uint), nIndividuals(), f) == nIndividuals();
+}
+
+bool
+MetaCommunity::read(FILE* const f)
+{
+  Randomizer r;
+  if( !(get(f, timeStamp) && get(f, lastSpecies) &&
+	fread(r.s, sizeof(r.s), 1, f) == 1 &&
+	fread(community, sizeof(uint), nIndividuals(), f) == nIndividuals()) ) {
+    return false;
+  }
+  if( (r.s[0] | r.s[1] | r.s[2] | r.s[3]) == 0 ) {
+    return false;
+  }
+  for(unsigned long k = 0; k < nIndividuals(); ++k) {
+    if( community[k] > lastSpecies ) {
+      return false;
+    }
+  }
+  recount();
+  rng = r;
+  return true;
+}
+
+void
+MetaCommunity::asBuffer(Py_buffer& view, PyObject* const owner)
+{
+  view.buf = community;
+  view.obj = owner;
+  Py_INCREF(owner);
+  view.len = nIndividuals() * sizeof(uint);
+  view.readonly = 1;
+  view.itemsize = sizeof(uint);
+  view.format = const_cast<char*>("I");
+  view.ndim = 2;
+  view.shape = shape;
+  view.strides = strides;
+  view.suboffsets = 0;
+  view.internal = 0;
+}
+
 class TracedMetaCommunity : public MetaCommunity {
 public:
   TracedMetaCommunity(uint nPlots, uint plotSize, double timeStamp = 0);
@@ -152,52 +761,92 @@ public:
 
   PyObject* asPyObject(void);
 
+  // Checkpoint including all trace nodes, so a restored community continues
+  // exactly as the original would.
+  bool write(FILE* f) const;
+  bool read(FILE* f);
+
   const PatchTrace*	ca(uint p0, uint i0, uint p1, uint i1) const;
 
-  void 	optTraces(void);
+  // Time of the most recent common ancestor of the whole community. O(1),
+  // the ancestor is maintained as the community changes.
+  double 		caTime(void) const { return mrca->pTime; }
+  
+  // Collapse each chain of nodes with a single descendant branch to its
+  // last node, with plots split between 'nThreads' threads. Plots of a
+  // thread which can not be started are done by the caller. May throw
+  // std::bad_alloc, before any change.
+  void 	optTraces(uint nThreads = 1);
+
+  size_t	traceNodes(void) const { return pool.size(); }
+  size_t	peakTraceNodes(void) const { return pool.peakSize(); }
+  // Total wall time spent in cleanUp, and number of calls
+  double	cleanUpTime(void) const { return cleanUpSeconds; }
+  unsigned long cleanUpsCount(void) const { return nCleanUps; }
+
+  // Current trace of individual k
+  const PatchTrace*	traceAt(unsigned long k) const { return trace[k]; }
+
+  // The node all traces start from, which has no plot
+  bool isFounder(const PatchTrace* p) const { return p == &founder; }
+
+  // Live trace nodes, numbered so that a parent comes before its children,
+  // with the parent of each (-1 for the root) and the node of each
+  // individual.
+  void numberNodes(vector<const PatchTrace*>& nodes, vector<int>& parent,
+		   vector<uint>& leaf) const;
   
 private:
-  PatchTrace*** trace;
+  PatchTracePool pool;
+  // current trace of each individual, parallel to the species array
+  PatchTrace** trace;
   mutable PatchTrace founder;
 
+  PatchTrace*& traceOf(uint np, uint ni) const { return trace[np * plotSize + ni]; }
+
+  // Common ancestor of all individuals. All nodes above it have exactly one
+  // descendant branch.
+  PatchTrace* mrca;
+
+  double	cleanUpSeconds;
+  unsigned long nCleanUps;
+  // number of optTraces passes
+  uint		nOptPasses;
+
+  // Number of descendant branches of a node (including the individual
+  // itself when the node is a current trace). The founder holds one
+  // extra reference so it is never released.
+  int nBranches(const PatchTrace* p) const {
+    return p == &founder ? p->refCount - 1 : p->refCount;
+  }
+  
+  void updateCA(const PatchTrace* live);
+
   PatchTrace*		ca(void) const;
   const PatchTrace*	ca(uint n) const;
 };
 
 TracedMetaCommunity::TracedMetaCommunity(uint nPlots, uint plotSize, double timeStamp) :
   MetaCommunity(nPlots, plotSize, timeStamp),
-  founder(-1, -1, -1, -1, 0)
+  founder(-1, -1, -1, -1, 0),
+  mrca(&founder),
+  cleanUpSeconds(0),
+  nCleanUps(0),
+  nOptPasses(0)
 {
-  trace = new PatchTrace** [nPlots];
+  trace = new PatchTrace* [nIndividuals()];
   for(uint np = 0; np < nPlots; ++np) {
-    trace[np] = new PatchTrace* [plotSize];
     for(uint ni = 0; ni < plotSize; ++ni) {
-      PatchTrace* pt = new PatchTrace(timeStamp, np, ni, 0, &founder);
+      PatchTrace* pt = pool.make(timeStamp, np, ni, 0, &founder);
       ++founder.refCount;
-      trace[np][ni] = pt;
+      traceOf(np, ni) = pt;
     }
   }
 }
 
 TracedMetaCommunity::~TracedMetaCommunity()
 {
-  for(uint np = 0; np < nPlots; ++np) {
-    for(uint ni = 0; ni < plotSize; ++ni) {
-      PatchTrace* p = trace[np][ni];
-      PatchTrace* pp = p->prev;
-      while( pp && pp != &founder ) {
-	if( pp->refCount > 1 ) {
-	  -- pp->refCount;
-	  break;
-	}
-	PatchTrace* px = pp->prev;
-	delete pp;
-	pp = px;
-      }
-      delete p;
-    }
-    delete [] trace[np];
-  }
+  // trace nodes go away with the pool
   delete [] trace;
 }
 
@@ -205,24 +854,23 @@ void
 TracedMetaCommunity::setSpecies(uint np, uint ni, uint s)
 {
   MetaCommunity::setSpecies(np, ni, s);
-  trace[np][ni]->speciesIndex = s;
+  traceOf(np, ni)->speciesIndex = s;
 }
 
 void
 TracedMetaCommunity::replace(uint np, uint nt, uint np1, uint nt1, double t, uint sx)
 {
-  Patch& p = get(np, nt);
-  p.speciesIndex = sx;
-  PatchTrace* const prev = trace[np1][nt1];
+  MetaCommunity::setSpecies(np, nt, sx);
+  PatchTrace* const prev = traceOf(np1, nt1);
   ++ prev->refCount;
   
-  PatchTrace*& cur = trace[np][nt];
+  PatchTrace*& cur = traceOf(np, nt);
   -- cur->refCount;
   {
     PatchTrace* p = cur;
     while( p->refCount == 0 ) {
       PatchTrace* p1 = p->prev;
-      delete p;
+      pool.release(p);
       p = p1;
       assert( p && p->refCount > 0 );
       --p->refCount;
@@ -236,13 +884,34 @@ TracedMetaCommunity::replace(uint np, uint nt, uint np1, uint nt1, double t, uin
       // assert( p->refCount > 0 );
       // --p->refCount;
     }
+    // p is the last node to lose a branch. Only when this leaves the common
+    // ancestor with a single branch does the ancestor move down.
+    if( p == mrca && nBranches(p) == 1 ) {
+      updateCA(prev);
+    }
   }
     
-  PatchTrace* n = new PatchTrace(t, np1, nt1, sx, prev);
+  PatchTrace* n = pool.make(t, np1, nt1, sx, prev);
 
   cur = n;
 }
 
+void
+TracedMetaCommunity::updateCA(const PatchTrace* x)
+{
+  // The new ancestor is the top-most node with more than one branch on the
+  // path from any living individual to the old one, since all nodes in
+  // between have just the one.
+  const PatchTrace* top = x;
+  while( x != mrca ) {
+    if( nBranches(x) > 1 ) {
+      top = x;
+    }
+    x = x->prev;
+  }
+  mrca = const_cast<PatchTrace*>(top);
+}
+
 #if 0 
 
 static const PatchTrace*
@@ -285,7 +954,7 @@ commonAnc(const PatchTrace* x, const PatchTrace* y)
 const PatchTrace*
 TracedMetaCommunity::ca(uint n) const
 {
-  PatchTrace** pn = trace[n];
+  PatchTrace** pn = trace + n * plotSize;
   const PatchTrace* x = pn[0];
   for(uint k = 1; k < plotSize; ++k) {
     x = commonAnc(x, pn[k]);
@@ -309,10 +978,13 @@ TracedMetaCommunity::ca(void) const
 const PatchTrace*
 TracedMetaCommunity::ca(uint p0, uint i0, uint p1, uint i1) const
 {
-  return commonAnc(trace[p0][i0], trace[p1][i1]);
+  return commonAnc(traceOf(p0, i0), traceOf(p1, i1));
 }
 
-#if !defined(NDEBUG)
+// Expensive (O(size x depth)) consistency checks of the traces
+// #define CHECK_TRACES
+
+#if defined(CHECK_TRACES)
 static bool
 onPath(const PatchTrace* p, const PatchTrace* c)
 {
@@ -326,33 +998,34 @@ onPath(const PatchTrace* p, const PatchTrace* c)
 const PatchTrace*
 TracedMetaCommunity::cleanUp(void)
 {
-  PatchTrace* const can = ca();
-#if !defined(NDEBUG)
+  PatchTrace* const can = mrca;
+  auto const start = std::chrono::steady_clock::now();
+#if defined(CHECK_TRACES)
+  assert( can == ca() );
   {
     for(uint np = 0; np < nPlots; ++np) {
       for(uint ni = 0; ni < plotSize; ++ni) {
-	assert( onPath(trace[np][ni], can) );
+	assert( onPath(traceOf(np, ni), can) );
       }
     }
   }
 #endif
   
-  {
-    PatchTrace* p = can->prev;
-    while( p && p->prev ) {
-      assert(p->refCount == 1);
-      p = p->prev;
-    }
-  }
-  
-  PatchTrace* p = can->prev;
+  // The chain above the ancestor goes back to the pool in one piece, up to
+  // the founder or including the root left by the previous clean up.
+  PatchTrace* const head = can->prev;
   can->prev = 0;
-  while( p && p->prev ) {
+  PatchTrace* tail = 0;
+  size_t n = 0;
+  for(PatchTrace* p = head; p && p != &founder; p = p->prev) {
     assert(p->refCount == 1);
-    PatchTrace* c = p->prev;
-    delete p;
-    p = c;
+    tail = p;
+    ++n;
   }
+  pool.release(head, tail, n);
+  cleanUpSeconds +=
+    std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  ++nCleanUps;
   return can;
 }
 
@@ -361,16 +1034,20 @@ PyObject*
 TracedMetaCommunity::asPyObject(void)
 {
   const PatchTrace* const ca = cleanUp();
+  PatchTraceObjects done;
+  
+  PyObject* f = 0;
   if( ca == &founder ) {
-    founder.asp = PyTuple_New(4);
-    PyTuple_SET_ITEM(founder.asp, 0, PyFloat_FromDouble(-1));
+    f = PyTuple_New(4);
+    PyTuple_SET_ITEM(f, 0, PyFloat_FromDouble(-1));
     PyObject* u2 = PyTuple_New(2);
     PyTuple_SET_ITEM(u2, 0, PyInt_FromLong(-1));
     PyTuple_SET_ITEM(u2, 1, PyInt_FromLong(-1));
-    PyTuple_SET_ITEM(founder.asp, 1, u2);
-    PyTuple_SET_ITEM(founder.asp, 2, PyInt_FromLong(-1));
+    PyTuple_SET_ITEM(f, 1, u2);
+    PyTuple_SET_ITEM(f, 2, PyInt_FromLong(-1));
     Py_INCREF(Py_None);
-    PyTuple_SET_ITEM(founder.asp, 3, Py_None);
+    PyTuple_SET_ITEM(f, 3, Py_None);
+    done[&founder] = f;
   }
   
   PyObject* p2 = PyTuple_New(2);
@@ -380,8 +1057,8 @@ TracedMetaCommunity::asPyObject(void)
   for(uint np = 0; np < nPlots; ++np) {
     PyObject* p = PyTuple_New(plotSize);
     for(uint ni = 0; ni < plotSize; ++ni) {
-      PatchTrace* t = trace[np][ni];
-      PyObject* x = t->asPyObject();
+      PatchTrace* t = traceOf(np, ni);
+      PyObject* x = t->asPyObject(done);
       PyTuple_SET_ITEM(p, ni, x);
     }
     PyTuple_SET_ITEM(o, np, p);
@@ -389,53 +1066,644 @@ TracedMetaCommunity::asPyObject(void)
   
   PyTuple_SET_ITEM(p2, 1, o);
 
-  const_cast<PatchTrace*>(ca)->asp = 0;
-  
-  for(uint np = 0; np < nPlots; ++np) {
-    for(uint ni = 0; ni < plotSize; ++ni) {
-      PatchTrace* t = trace[np][ni];
-      while( t->asp ) {
-	t->asp = 0;
-	t = t->prev;
-	assert( t ) ;
-      }
-    }
-  }
-  assert( founder.asp == 0 ) ;
+  // founder tuple now held by its descendants
+  Py_XDECREF(f);
   
   return p2;
 }
 
 void
-TracedMetaCommunity::optTraces(void)
+TracedMetaCommunity::numberNodes(vector<const PatchTrace*>& nodes, vector<int>& parent,
+				 vector<uint>& leaf) const
 {
-  for(uint np = 0; np < nPlots; ++np) {
-    for(uint ni = 0; ni < plotSize; ++ni) {
-      PatchTrace* p = trace[np][ni];
-      while( p != &founder && p->prev ) {
-	if( p->prev != &founder && p->prev->refCount == 1 &&
-	    p->prev->prev != &founder &&  p->prev->prev->refCount == 1 ) {
-	  PatchTrace* x = p->prev;
-	  p->prev = x->prev;
-	  delete x;
-	} else {
-	  p = p->prev;
-	}
-      }
+  std::unordered_map<const PatchTrace*, uint> ids;
+  vector<const PatchTrace*> path;
+  leaf.resize(nIndividuals());
+  for(unsigned long k = 0; k < nIndividuals(); ++k) {
+    const PatchTrace* p = trace[k];
+    for(; p && ids.find(p) == ids.end(); p = p->prev) {
+      path.push_back(p);
     }
+    int pid = p ? ids[p] : -1;
+    while( ! path.empty() ) {
+      uint const id = nodes.size();
+      ids[path.back()] = id;
+      nodes.push_back(path.back());
+      parent.push_back(pid);
+      pid = id;
+      path.pop_back();
+    }
+    leaf[k] = ids[trace[k]];
   }
 }
 
-class MetaSimulator {
-public:
-  MetaSimulator(double mu, double lam, double rho);
-  ~MetaSimulator() {}
-
-  double advance(double targetTime, MetaCommunity& com);
+// Trace nodes are numbered so that a parent is written before its children.
+// 0 is the founder, 'noNode' stands for no parent (root after a clean up).
+static uint32_t const noNode = ~static_cast<uint32_t>(0);
 
-  double advance(double targetTime, TracedMetaCommunity& com, double minCAtime, double cleanEvery);
-  
+bool
+TracedMetaCommunity::write(FILE* const f) const
+{
+  if( ! MetaCommunity::write(f) ) {
+    return false;
+  }
+  
+  std::unordered_map<const PatchTrace*, uint32_t> ids;
+  ids[&founder] = 0;
+  vector<const PatchTrace*> nodes;
+  nodes.reserve(pool.size());
+  vector<const PatchTrace*> path;
+  for(unsigned long k = 0; k < nIndividuals(); ++k) {
+    for(const PatchTrace* p = trace[k]; p && ids.find(p) == ids.end(); p = p->prev) {
+      path.push_back(p);
+    }
+    while( ! path.empty() ) {
+      ids[path.back()] = nodes.size() + 1;
+      nodes.push_back(path.back());
+      path.pop_back();
+    }
+  }
+
+  if( !(put(f, static_cast<uint32_t>(nodes.size())) && put(f, ids[mrca])) ) {
+    return false;
+  }
+  for(auto n = nodes.begin(); n != nodes.end(); ++n) {
+    const PatchTrace& p = **n;
+    uint16_t const pl = p.fromPlot, pt = p.fromPatch;
+    uint32_t const prev = p.prev ? ids[p.prev] : noNode;
+    if( !(put(f, p.pTime) && put(f, pl) && put(f, pt) &&
+	  put(f, static_cast<uint32_t>(p.speciesIndex)) && put(f, prev)) ) {
+      return false;
+    }
+  }
+  for(unsigned long k = 0; k < nIndividuals(); ++k) {
+    if( ! put(f, ids[trace[k]]) ) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool
+TracedMetaCommunity::read(FILE* const f)
+{
+  if( ! MetaCommunity::read(f) ) {
+    return false;
+  }
+
+  // drop initial traces
+  for(unsigned long k = 0; k < nIndividuals(); ++k) {
+    pool.release(trace[k]);
+    trace[k] = &founder;
+  }
+  founder.refCount = 1;
+  
+  uint32_t nNodes, mrcaId;
+  if( !(get(f, nNodes) && get(f, mrcaId)) || mrcaId > nNodes ) {
+    return false;
+  }
+  
+  // Reference counts are rebuilt from the links: one per child, plus one
+  // for being the current trace of an individual.
+  vector<PatchTrace*> nodes(nNodes + 1);
+  nodes[0] = &founder;
+  for(uint32_t n = 1; n <= nNodes; ++n) {
+    double t;
+    uint16_t pl, pt;
+    uint32_t sp, prev;
+    if( !(get(f, t) && get(f, pl) && get(f, pt) && get(f, sp) && get(f, prev)) ) {
+      return false;
+    }
+    if( prev != noNode && prev >= n ) {
+      return false;
+    }
+    PatchTrace* const p = pool.make(t, pl, pt, sp, prev != noNode ? nodes[prev] : 0);
+    p->refCount = 0;
+    if( p->prev ) {
+      ++p->prev->refCount;
+    }
+    nodes[n] = p;
+  }
+  for(unsigned long k = 0; k < nIndividuals(); ++k) {
+    uint32_t id;
+    if( !get(f, id) || id > nNodes ) {
+      return false;
+    }
+    trace[k] = nodes[id];
+    ++trace[k]->refCount;
+  }
+  mrca = nodes[mrcaId];
+  return true;
+}
+
+void
+TracedMetaCommunity::optTraces(uint const nThreads)
+{
+  // A node with one reference is reached only through that reference, so
+  // only nodes shared by several branches need a claim. The walk that
+  // claims a shared node collapses the chain above it and goes on, any
+  // other walk reaching it stops there. Each chain is then changed by
+  // exactly one walk, and no node is visited twice.
+  uint const pass = ++nOptPasses;
+  uint const nParts = std::max(std::min(nThreads, nPlots), 1U);
+  
+  struct Released {
+    Released() : head(0), tail(0), n(0) {}
+    PatchTrace* head;
+    PatchTrace* tail;
+    size_t	n;
+  };
+  vector<Released> released(nParts);
+  
+  auto part = [&](uint const k) {
+    uint const firstPlot = (static_cast<unsigned long>(nPlots) * k) / nParts;
+    uint const endPlot = (static_cast<unsigned long>(nPlots) * (k+1)) / nParts;
+    Released& r = released[k];
+
+    auto unary = [this](const PatchTrace* const x) {
+      return x && x != &founder && x->refCount == 1;
+    };
+    
+    for(uint np = firstPlot; np < endPlot; ++np) {
+      for(uint ni = 0; ni < plotSize; ++ni) {
+	PatchTrace* p = traceOf(np, ni);
+	while( p != &founder && p->prev ) {
+	  if( p->refCount > 1 &&
+	      p->claimedBy.exchange(pass, std::memory_order_relaxed) == pass ) {
+	    break;
+	  }
+	  while( unary(p->prev) && unary(p->prev->prev) ) {
+	    PatchTrace* const x = p->prev;
+	    p->prev = x->prev;
+	    // chained to the released ones, returned to the pool at the end
+	    x->prev = r.head;
+	    r.head = x;
+	    if( ! r.tail ) {
+	      r.tail = x;
+	    }
+	    ++r.n;
+	  }
+	  p = p->prev;
+	}
+      }
+    }
+  };
+
+  if( nParts == 1 ) {
+    part(0);
+  } else {
+    // parts are independent, one which can not get a thread runs here
+    vector<std::thread> threads;
+    threads.reserve(nParts);
+    for(uint k = 1; k < nParts; ++k) {
+      try {
+	threads.push_back(std::thread(part, k));
+      } catch (std::system_error&) {
+	part(k);
+      }
+    }
+    part(0);
+    for(auto t = threads.begin(); t != threads.end(); ++t) {
+      t->join();
+    }
+  }
+  
+  for(auto r = released.begin(); r != released.end(); ++r) {
+    pool.release(r->head, r->tail, r->n);
+  }
+}
+
+// Static snapshot of the traces of a community as a tree, indexed for O(1)
+// common ancestor queries: an Euler tour of the tree with a sparse table of
+// range minimum depths. Built in O(n log n) for n live trace nodes.
+class TraceIndex {
+public:
+  explicit TraceIndex(TracedMetaCommunity const& com);
+
+  // Common ancestor of individuals k0 and k1
+  const PatchTrace* ca(unsigned long k0, unsigned long k1) const {
+    uint l = first[leaf[k0]], r = first[leaf[k1]];
+    if( l > r ) {
+      std::swap(l, r);
+    }
+    uint const j = log2floor(r - l + 1);
+    uint const a = table[j][l], b = table[j][r + 1 - (1U << j)];
+    return nodes[depth[a] <= depth[b] ? a : b];
+  }
+  
+private:
+  static uint log2floor(uint x) { return 31 - __builtin_clz(x); }
+
+  vector<const PatchTrace*> nodes;
+  vector<uint>		    depth;
+  // node of each individual
+  vector<uint>		    leaf;
+  // first position of each node in the tour
+  vector<uint>		    first;
+  // table[j][i] is the shallowest node of tour positions [i, i + 2^j)
+  vector< vector<uint> >    table;
+};
+
+TraceIndex::TraceIndex(TracedMetaCommunity const& com)
+{
+  vector<int> parent;
+  com.numberNodes(nodes, parent, leaf);
+  uint const n = nodes.size();
+  
+  // children in one array
+  vector<uint> cstart(n + 1, 0), children(n);
+  for(uint x = 0; x < n; ++x) {
+    if( parent[x] >= 0 ) {
+      ++cstart[parent[x] + 1];
+    } else {
+      assert( x == 0 );
+    }
+  }
+  for(uint x = 0; x < n; ++x) {
+    cstart[x+1] += cstart[x];
+  }
+  {
+    vector<uint> pos(cstart.begin(), cstart.end() - 1);
+    for(uint x = 0; x < n; ++x) {
+      if( parent[x] >= 0 ) {
+	children[pos[parent[x]]++] = x;
+      }
+    }
+  }
+
+  // Euler tour, without recursion since the tree may be very deep. All
+  // traces descend from one root, the founder or the root left by a clean
+  // up.
+  depth.assign(n, 0);
+  first.assign(n, 0);
+  vector<uint> tour;
+  tour.reserve(2*n);
+  vector< std::pair<uint,uint> > stack;
+  stack.push_back(std::make_pair(0U, cstart[0]));
+  first[0] = 0;
+  tour.push_back(0);
+  while( ! stack.empty() ) {
+    uint const x = stack.back().first;
+    uint& c = stack.back().second;
+    if( c < cstart[x+1] ) {
+      uint const y = children[c++];
+      depth[y] = depth[x] + 1;
+      first[y] = tour.size();
+      tour.push_back(y);
+      stack.push_back(std::make_pair(y, cstart[y]));
+    } else {
+      stack.pop_back();
+      if( ! stack.empty() ) {
+	tour.push_back(stack.back().first);
+      }
+    }
+  }
+
+  uint const m = tour.size();
+  table.push_back(tour);
+  for(uint j = 1; (1U << j) <= m; ++j) {
+    vector<uint> const& prev = table[j-1];
+    uint const h = 1U << (j-1);
+    vector<uint> t(m - (1U << j) + 1);
+    for(uint i = 0; i < t.size(); ++i) {
+      uint const a = prev[i], b = prev[i + h];
+      t[i] = depth[a] <= depth[b] ? a : b;
+    }
+    table.push_back(std::move(t));
+  }
+}
+
+// Records the community at given times while a simulation advances: the
+// abundance summaries and/or a snapshot of all species. The state recorded
+// for time t is the one just before the first event after t.
+class SampleRecorder {
+public:
+  // 'times' sorted
+  SampleRecorder(vector<double> const& times, bool stats, bool snapshots);
+
+  // Time of next sample, infinity when done
+  double next(void) const { return nRecorded < times.size() ? times[nRecorded] : HUGE_VAL; }
+
+  // Record all samples before time t
+  void record(double t, MetaCommunity const& com) {
+    while( next() < t ) {
+      recordNext(com);
+    }
+  }
+
+  // Record all samples at or before time t, for runs which stop exactly at
+  // sample times
+  void recordThrough(double t, MetaCommunity const& com) {
+    while( next() <= t ) {
+      recordNext(com);
+    }
+  }
+  
+  // Simulation stopped at time t before reaching all sample times: the
+  // state at t is the last sample, in place of all those left.
+  void stop(double t, MetaCommunity const& com) {
+    if( nRecorded < times.size() ) {
+      times.resize(nRecorded);
+      times.push_back(t);
+      recordNext(com);
+    }
+  }
+  
+  // Summaries list and/or species snapshots of all samples taken, as one
+  // string of uint32 (sample x plot x individual).
+  PyObject* asPyObject(void) const;
+  
+private:
+  void recordNext(MetaCommunity const& com);
+  
+  vector<double>       times;
+  bool const	       stats;
+  bool const	       snapshots;
+  uint		       nRecorded;
+
+  vector< vector<AbundanceStats::Summary> > summaries;
+  vector<uint>			       species;
+};
+
+SampleRecorder::SampleRecorder(vector<double> const& _times, bool _stats, bool _snapshots) :
+  times(_times),
+  stats(_stats),
+  snapshots(_snapshots),
+  nRecorded(0)
+{}
+
+void
+SampleRecorder::recordNext(MetaCommunity const& com)
+{
+  if( stats ) {
+    summaries.push_back(vector<AbundanceStats::Summary>());
+    com.getAbundance()->summaries(summaries.back());
+  }
+  if( snapshots ) {
+    unsigned long const n = com.nIndividuals();
+    species.reserve(times.size() * n);
+    for(unsigned long k = 0; k < n; ++k) {
+      species.push_back(com.species(k));
+    }
+  }
+  ++nRecorded;
+}
+
+PyObject*
+SampleRecorder::asPyObject(void) const
+{
+  PyObject* sm = 0;
+  if( stats ) {
+    sm = PyList_New(nRecorded);
+    for(uint k = 0; k < nRecorded; ++k) {
+      PyList_SET_ITEM(sm, k, AbundanceStats::asPyObject(times[k], summaries[k]));
+    }
+  }
+  PyObject* sp = 0;
+  if( snapshots ) {
+    sp = PyString_FromStringAndSize(reinterpret_cast<const char*>(species.data()),
+				    species.size() * sizeof(uint));
+  }
+  if( sm && sp ) {
+    return Py_BuildValue("NN", sm, sp);
+  }
+  return sm ? sm : sp;
+}
+
+// Genealogy of a sample. Nodes are in order of creation (sampled individuals
+// first, root last), so a parent always comes after its children.
+struct SampleGenealogy {
+  // index of parent node, -1 for the root
+  vector<int>    parent;
+  // time before present
+  vector<double> age;
+  // plot of the individual carrying the lineage at that time
+  vector<uint>   plot;
+  // species of the lineage at that time
+  vector<uint>   species;
+
+  uint add(int p, double a, uint pl) {
+    parent.push_back(p);
+    age.push_back(a);
+    plot.push_back(pl);
+    return parent.size() - 1;
+  }
+};
+
+// Random draws of the event loop straight from the community stream, through
+// the standard distributions (one call of the engine or more per draw).
+class StdDraws {
+public:
+  StdDraws(Randomizer& _rng, double rate, uint nIndividuals, uint plotSize) :
+    rng(_rng),
+    toNextDeath(rate),
+    globIndividual(0, nIndividuals-1),
+    localIndividual(0, plotSize-1),
+    unif(0.0, 1.0)
+    {}
+  
+  double timeToNextDeath(void) { return toNextDeath(rng); }
+  uint pickGlobIndividual(void) { return globIndividual(rng); }
+  uint pickLocalIndividual(void) { return localIndividual(rng); }
+  double zeroOne(void) { return unif(rng); }
+  uint below(uint n) { return std::uniform_int_distribution<uint>(0, n-1)(rng); }
+  uint64_t bits(void) { return rng(); }
+  
+private:
+  Randomizer& rng;
+  std::exponential_distribution<double> toNextDeath;
+  std::uniform_int_distribution<int> globIndividual;
+  std::uniform_int_distribution<int> localIndividual;
+  std::uniform_real_distribution<double> unif;
+};
+
+// Same draws from a block generator seeded from the community stream. Each
+// draw takes exactly one value of the block.
+class BlockDraws {
+public:
+  BlockDraws(Randomizer& rng, double _rate, uint _nIndividuals, uint _plotSize) :
+    block(rng),
+    rate(_rate),
+    nIndividuals(_nIndividuals),
+    plotSize(_plotSize)
+    {}
+  
+  double timeToNextDeath(void) { return block.exponential(rate); }
+  uint pickGlobIndividual(void) { return block.below(nIndividuals); }
+  uint pickLocalIndividual(void) { return block.below(plotSize); }
+  double zeroOne(void) { return block.uniform(); }
+  uint below(uint n) { return block.below(n); }
+  uint64_t bits(void) { return block(); }
+  
+private:
+  RandomBlock  block;
+  double const rate;
+  uint const   nIndividuals;
+  uint const   plotSize;
+};
+
+// Plot of origin of immigrants into each plot. Sources of a plot and their
+// weights are given by a row of a dispersal matrix or by a distance kernel,
+// and are sampled in O(1) by Walker's alias method. The tables of all plots
+// are kept in one array, so a draw touches a single cache line or two.
+class Dispersal {
+public:
+  explicit Dispersal(uint _nPlots) : nRows(_nPlots), start(1, 0) {}
+
+  uint nPlots(void) const { return nRows; }
+  
+  // Sources of immigrants into plot np with their (relative) weights. Plots
+  // are set in order. False if no source has a positive weight.
+  bool setSources(uint np, vector<uint> const& plots, vector<double> const& weights);
+
+  // One 64 bit draw picks the column (high half) and tosses its coin (low
+  // half).
+  template<typename Draws>
+  uint source(uint np, Draws& draw) const {
+    uint64_t const x = draw.bits();
+    size_t const b = start[np];
+    Entry const& e = table[b + (((x >> 32) * (start[np+1] - b)) >> 32)];
+    return static_cast<uint32_t>(x) < e.threshold ? e.plot : e.alias;
+  }
+  
+private:
+  struct Entry {
+    // probability of column own plot, scaled to 2^32
+    uint64_t threshold;
+    uint     plot;
+    uint     alias;
+  };
+
+  uint const	nRows;
+  vector<size_t> start;
+  vector<Entry>  table;
+};
+
+bool
+Dispersal::setSources(uint const np, vector<uint> const& plots, vector<double> const& weights)
+{
+  assert( np + 1 == start.size() );
+  
+  vector<double> prob;
+  double tot = 0;
+  for(uint k = 0; k < plots.size(); ++k) {
+    if( weights[k] > 0 ) {
+      Entry const e = {0, plots[k], plots[k]};
+      table.push_back(e);
+      prob.push_back(weights[k]);
+      tot += weights[k];
+    }
+  }
+  Entry* const row = table.data() + start.back();
+  uint const n = prob.size();
+  if( n == 0 ) {
+    return false;
+  }
+  start.push_back(table.size());
+  
+  // Vose: pair each under-full column with an over-full one
+  vector<uint> small, large;
+  for(uint k = 0; k < n; ++k) {
+    prob[k] *= n / tot;
+    (prob[k] < 1 ? small : large).push_back(k);
+  }
+  while( ! small.empty() && ! large.empty() ) {
+    uint const l = small.back(); small.pop_back();
+    uint const g = large.back();
+    row[l].alias = row[g].plot;
+    prob[g] -= 1 - prob[l];
+    if( prob[g] < 1 ) {
+      large.pop_back();
+      small.push_back(g);
+    }
+  }
+  // left overs are full up to rounding
+  for(auto k = small.begin(); k != small.end(); ++k) {
+    prob[*k] = 1;
+  }
+  for(auto k = large.begin(); k != large.end(); ++k) {
+    prob[*k] = 1;
+  }
+  for(uint k = 0; k < n; ++k) {
+    row[k].threshold = static_cast<uint64_t>(prob[k] * 4294967296.0);
+  }
+  return true;
+}
+
+// Diagnostics of an approximate (tau leaping) run. Within a step all births
+// draw from the plots as they were at the start of the step, so the error
+// grows with the fraction of a plot replaced in one step, about mu x tau.
+struct LeapStats {
+  LeapStats() : nSteps(0), nEvents(0), maxReplaced(0), nClipped(0) {}
+
+  unsigned long		nSteps;
+  unsigned long long	nEvents;
+  // highest fraction of a plot replaced in a single step
+  double		maxReplaced;
+  // deaths moved to another species because more died than the species
+  // had, plus deaths dropped because more than the whole plot died
+  unsigned long long	nClipped;
+};
+
+class MetaSimulator {
+public:
+  // Events draw from a block generator unless 'batchRandom' is false, in
+  // which case they draw one by one from the community stream.
+  MetaSimulator(double mu, double lam, double rho, bool batchRandom = true);
+  ~MetaSimulator() {}
+
+  // Advance community until just past 'targetTime', recording samples
+  // along the way when given a recorder.
+  double advance(double targetTime, MetaCommunity& com, SampleRecorder* rec = 0);
+
+  double advance(double targetTime, TracedMetaCommunity& com, double minCAtime, double cleanEvery,
+		 SampleRecorder* rec = 0);
+
+  // Advance with plots split between 'nThreads' threads. Each thread runs
+  // the events of its own plots. An immigrant from a plot of another
+  // thread takes the species that individual had at the start of the
+  // current epoch, which is the only departure from the sequential
+  // process: an immigrant is stale only if its parent died earlier in the
+  // same epoch, which happens with probability at most mu x epoch. Results
+  // are reproducible for a given number of threads. 'epoch' must be large
+  // enough to move the time forward. Throws std::system_error when threads
+  // can not be started.
+  double advance(double targetTime, MetaCommunity& com, uint nThreads, double epoch);
+
+  // Approximate advance by tau leaping, for abundance only studies. Plots
+  // are held as species counts. In each step of at most 'tau' the number of
+  // deaths in a plot is Poisson, and deaths and births are split between
+  // species by binomial draws, so a step costs the number of species rather
+  // than the number of events. Steps are cut to end at sample times and at
+  // 'targetTime', where the run ends exactly. Species numbers are not
+  // recycled within the run.
+  double leap(double targetTime, MetaCommunity& com, double tau, LeapStats& st,
+	      SampleRecorder* rec = 0);
+
+  // Genealogy of a sample from a community at equilibrium, simulated
+  // backward in time. 'sample' is the number of sampled individuals in each
+  // plot. Returns false when sampled lineages can never coalesce.
+  bool sampleGenealogy(uint nPlots, uint plotSize, vector<uint> const& sample,
+		       Randomizer& rng, SampleGenealogy& g) const;
+
+  // Immigrants come from plots given by 'd' rather than from a uniformly
+  // chosen individual. Not owned.
+  void setDispersal(Dispersal const* d) { dispersal = d; }
+  
 private:
+  template<typename Draws>
+  double advanceWith(double targetTime, MetaCommunity& com, SampleRecorder* rec);
+
+  template<typename Draws>
+  double advanceWith(double targetTime, TracedMetaCommunity& com, double minCAtime,
+		     double cleanEvery, SampleRecorder* rec);
+
+  template<typename Draws>
+  double advanceWith(double targetTime, MetaCommunity& com, uint nThreads, double epoch);
+
+  bool const batchRandom;
+  Dispersal const* dispersal;
+  
   double mu;
   double lam;
   double rho;
@@ -444,7 +1712,9 @@ private:
   double pLocalOrImi;
 };
 
-MetaSimulator::MetaSimulator(double _mu, double _lam, double _rho) :
+MetaSimulator::MetaSimulator(double _mu, double _lam, double _rho, bool _batchRandom) :
+  batchRandom(_batchRandom),
+  dispersal(0),
   mu(_mu),
   lam(_lam),
   rho(_rho)
@@ -458,20 +1728,12 @@ MetaSimulator::MetaSimulator(double _mu, double _lam, double _rho) :
   pLocalOrImi = p3[0]+p3[1];
 }
   
-static std::mt19937 randomizer;
-
-uint maxSpecies(MetaCommunity const& com) {
-  uint s = 0;
-  for(uint np = 0; np < com.nPlots; ++np) {
-    for(uint ni = 0; ni < com.plotSize; ++ni) {
-      s = std::max(com.get(np,ni).speciesIndex, s);
-    }
-  }
-  return s;
-}
+// Source of seeds for communities not given an explicit one.
+static std::mt19937 seeder;
 
+template<typename Draws>
 double
-MetaSimulator::advance(double targetTime, MetaCommunity& com)
+MetaSimulator::advanceWith(double targetTime, MetaCommunity& com, SampleRecorder* const rec)
 {
 #if !defined(NDEBUG)
   uint const nPlots = com.nPlots;
@@ -479,55 +1741,61 @@ MetaSimulator::advance(double targetTime, MetaCommunity& com)
   uint const plotSize = com.plotSize;
   uint const nIndividuals = com.nIndividuals();
 
-  uint lastSpecies = maxSpecies(com);
   
   double const dr = nIndividuals * mu;
-  std::exponential_distribution<double> timeToNextDeath(dr);
-  std::uniform_int_distribution<int> pickGlobIndividual(0, nIndividuals-1);
-  std::uniform_int_distribution<int> pickLocalIndividual(0, plotSize-1);
-  std::uniform_real_distribution<double> zeroOne(0.0, 1.0);
+  Draws draw(com.rng, dr, nIndividuals, plotSize);
 
   double curTime = com.getTime();
-
+  double nextSample = rec ? rec->next() : HUGE_VAL;
+  unsigned long long nEvents = 0;
+  
   while( curTime <= targetTime ) {
-    double const deltaT = timeToNextDeath(randomizer);
+    ++nEvents;
+    double const deltaT = draw.timeToNextDeath();
     curTime += deltaT;
-    uint const k = pickGlobIndividual(randomizer);
+    if( curTime > nextSample ) {
+      rec->record(curTime, com);
+      nextSample = rec->next();
+    }
+    uint const k = draw.pickGlobIndividual();
     uint const np = k / plotSize;         assert(0 <= np && np < nPlots);
     uint const nt = k - np * plotSize;    assert(0 <= nt && nt < plotSize );
-    double const r = zeroOne(randomizer);
+    double const r = draw.zeroOne();
 
     uint np1,nt1,sx;
     
     if( r < pLocal ) {
-      uint const i = pickLocalIndividual(randomizer);
-      sx = com.get(np, i).speciesIndex;
+      uint const i = draw.pickLocalIndividual();
+      sx = com.species(np, i);
       np1 = np;
       nt1 = i;
+    } else if( dispersal && r < pLocalOrImi ) {
+      np1 = dispersal->source(np, draw);
+      nt1 = draw.pickLocalIndividual();
+      sx = com.species(np1, nt1);
     } else {
-      uint const k1 = pickGlobIndividual(randomizer);
+      uint const k1 = draw.pickGlobIndividual();
       np1 = k1 / plotSize;         
       nt1 = k1 - np1 * plotSize; 
       if( r < pLocalOrImi ) {
-	sx = com.get(np1, nt1).speciesIndex;
+	sx = com.species(k1);
       } else {
-	lastSpecies += 1;
-	sx = lastSpecies;
-	// log
+	sx = com.newSpecies();
       }
     }
     com.setSpecies(np, nt, sx);
-    // Patch& p = com.get(np, nt);
-    // p.speciesIndex = sx;
   }
+  com.countEvents(nEvents);
   com.setTime(curTime);
   return curTime;
 }
 
 
+template<typename Draws>
 double
-MetaSimulator::advance(double targetTime, TracedMetaCommunity& com,
-		       double const minCAtime, double const xcleanEvery = 1)
+MetaSimulator::advanceWith(double targetTime, TracedMetaCommunity& com,
+			   double const minCAtime, double const xcleanEvery,
+			   SampleRecorder* const rec)
 {
 #if !defined(NDEBUG)
   uint const nPlots = com.nPlots;
@@ -535,121 +1803,830 @@ MetaSimulator::advance(double targetTime, TracedMetaCommunity& com,
   uint const plotSize = com.plotSize;
   uint const nIndividuals = com.nIndividuals();
 
-  uint lastSpecies = com.getLastSpecies();
   
   double const dr = nIndividuals * mu;
-  std::exponential_distribution<double> timeToNextDeath(dr);
-  std::uniform_int_distribution<int> pickGlobIndividual(0, nIndividuals-1);
-  std::uniform_int_distribution<int> pickLocalIndividual(0, plotSize-1);
-  std::uniform_real_distribution<double> zeroOne(0.0, 1.0);
+  Draws draw(com.rng, dr, nIndividuals, plotSize);
 
   double curTime = com.getTime();
-  // at least one clean in inner loop
-  //double const cleanEvery = std::min(1.0, targetTime * 0.99); // ???
-  double const cleanEvery = std::max(xcleanEvery, minCAtime); // ???
+  // Common ancestor is tracked as we go, cleaning only reclaims the trace
+  // above it.
+  double const cleanEvery = xcleanEvery;
   
   double cleanAt = curTime + cleanEvery;
-  // at least one loop to inital target time
-  // double curCAtime = -1;
+  double nextSample = rec ? rec->next() : HUGE_VAL;
+  unsigned long long nEvents = 0;
 
   // look until target time or CA time > minimum CA time
   while( curTime <= targetTime ) {
+    ++nEvents;
     {
-      double deltaT = timeToNextDeath(randomizer);
+      double deltaT = draw.timeToNextDeath();
       double cpd = curTime + deltaT;
       while( cpd == curTime ) {
-	deltaT = timeToNextDeath(randomizer);
+	deltaT = draw.timeToNextDeath();
 	cpd = curTime + deltaT;
       }
       curTime = cpd;
     }
+    if( curTime > nextSample ) {
+      rec->record(curTime, com);
+      nextSample = rec->next();
+    }
       
-    uint const k = pickGlobIndividual(randomizer);
+    uint const k = draw.pickGlobIndividual();
     uint const np = k / plotSize;         assert(0 <= np && np < nPlots);
     uint const nt = k - np * plotSize;    assert(0 <= nt && nt < plotSize );
-    double const r = zeroOne(randomizer);
+    double const r = draw.zeroOne();
 
     uint np1,nt1,sx;
     
     if( r < pLocal ) {
-      uint const i = pickLocalIndividual(randomizer);
-      sx = com.get(np, i).speciesIndex;
+      uint const i = draw.pickLocalIndividual();
+      sx = com.species(np, i);
       np1 = np;
       nt1 = i;
+    } else if( dispersal && r < pLocalOrImi ) {
+      np1 = dispersal->source(np, draw);
+      nt1 = draw.pickLocalIndividual();
+      sx = com.species(np1, nt1);
     } else {
-      uint const k1 = pickGlobIndividual(randomizer);
+      uint const k1 = draw.pickGlobIndividual();
       np1 = k1 / plotSize;         
       nt1 = k1 - np1 * plotSize; 
       if( r < pLocalOrImi ) {
-	sx = com.get(np1, nt1).speciesIndex;
+	sx = com.species(k1);
       } else {
-	lastSpecies += 1;
-	sx = lastSpecies;
+	sx = com.newSpecies();
       }
     }
     com.replace(np, nt, np1, nt1, curTime, sx);
 
+    if( minCAtime >= 0 && com.caTime() > minCAtime ) {
+      break;
+    }
+    
     if( curTime >= cleanAt ) {
-      const PatchTrace* const ca = com.cleanUp();
-      double const curCAtime = ca->pTime;
-      
-      if( minCAtime >= 0 && curCAtime > minCAtime ) {
-	break;
-      }
-      
+      com.cleanUp();
       cleanAt += cleanEvery;
     }
   }
+  if( rec ) {
+    rec->stop(curTime, com);
+  }
 
+  com.countEvents(nEvents);
   com.setTime(curTime);
   return curTime;
 }
 
-static void
-metaDestructor(PyObject* const o)
+double
+MetaSimulator::advance(double targetTime, MetaCommunity& com, SampleRecorder* const rec)
 {
-  if( PyCapsule_IsValid(o, "TMC") ) {
-    void* c = PyCapsule_GetPointer(o, "TMC");
-    delete reinterpret_cast<TracedMetaCommunity*>(c);
-  } else if( PyCapsule_IsValid(o, "MC") ) {
-    void* c = PyCapsule_GetPointer(o, "MC");
-    delete reinterpret_cast<MetaCommunity*>(c);
-  }
+  return batchRandom ? advanceWith<BlockDraws>(targetTime, com, rec) :
+    advanceWith<StdDraws>(targetTime, com, rec);
 }
 
-PyObject*
-newCommunity(PyObject*, PyObject* args, PyObject* kwds)
+double
+MetaSimulator::advance(double targetTime, TracedMetaCommunity& com,
+		       double const minCAtime, double const cleanEvery,
+		       SampleRecorder* const rec)
 {
-  static const char *kwlist[] = {"nPlots", "plotSize", "startTime", "trace", "metaCommunity", 
-				 static_cast<const char*>(0)};
-  PyObject* metaCom = 0;
-  double startTime = 0;
-  uint nPlots = 0, plotSize = 0;
-  PyObject* pyTrace = 0;
+  return batchRandom ?
+    advanceWith<BlockDraws>(targetTime, com, minCAtime, cleanEvery, rec) :
+    advanceWith<StdDraws>(targetTime, com, minCAtime, cleanEvery, rec);
+}
+
+// Threads wait at the barrier until all have reached it
+class Barrier {
+public:
+  explicit Barrier(uint _n) : n(_n), waiting(0), generation(0) {}
+
+  void wait(void) {
+    std::unique_lock<std::mutex> lock(m);
+    uint const g = generation;
+    if( ++waiting == n ) {
+      waiting = 0;
+      ++generation;
+      cv.notify_all();
+    } else {
+      cv.wait(lock, [&]{ return g != generation; });
+    }
+  }
   
-  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "|iidOO", const_cast<char**>(kwlist),
-				    &nPlots,&plotSize,&startTime,&pyTrace,&metaCom)) {
-    PyErr_SetString(PyExc_ValueError, "wrong args.") ;
-    return 0;
+private:
+  std::mutex		  m;
+  std::condition_variable cv;
+  uint const		  n;
+  uint			  waiting;
+  uint			  generation;
+};
+
+// Threads wait at the gate until it is opened, to run or to quit without
+// running when not all of them could be started
+class StartGate {
+public:
+  StartGate() : state(0) {}
+
+  // true to run
+  bool wait(void) {
+    std::unique_lock<std::mutex> lock(m);
+    cv.wait(lock, [&]{ return state != 0; });
+    return state > 0;
+  }
+
+  void open(bool run) {
+    std::lock_guard<std::mutex> lock(m);
+    state = run ? 1 : -1;
+    cv.notify_all();
   }
   
-  bool const trace = (pyTrace && PyObject_IsTrue(pyTrace));
+private:
+  std::mutex		  m;
+  std::condition_variable cv;
+  int			  state;
+};
+
+double
+MetaSimulator::advance(double const targetTime, MetaCommunity& com,
+		       uint const nThreads, double const epoch)
+{
+  return batchRandom ? advanceWith<BlockDraws>(targetTime, com, nThreads, epoch) :
+    advanceWith<StdDraws>(targetTime, com, nThreads, epoch);
+}
+
+template<typename Draws>
+double
+MetaSimulator::advanceWith(double const targetTime, MetaCommunity& com,
+			   uint const nThreads, double const epoch)
+{
+  uint const nPlots = com.nPlots;
+  uint const plotSize = com.plotSize;
+  unsigned long const nIndividuals = com.nIndividuals();
+  uint const nParts = std::max(std::min(nThreads, nPlots), 1U);
   
-  MetaCommunity* com = 0;
-  TracedMetaCommunity* tcom = 0;
+  // Threads update 'live', and read plots of other threads from 'snap',
+  // their state at the start of the epoch.
+  vector<uint> live(nIndividuals);
+  for(unsigned long k = 0; k < nIndividuals; ++k) {
+    live[k] = com.species(k);
+  }
+  vector<uint> snap(live);
+
+  // New species of part p are lastSpecies + 1 + p + j x nParts, unique
+  // without any coordination.
+  uint const lastSpecies = com.getLastSpecies();
+  double const startTime = com.getTime();
+
+  // Part p draws from the community stream jumped p times or more: each
+  // part takes the stream as left by the one before it (past all lanes of a
+  // block generator) and jumps it once.
+  vector<Randomizer> streams(nParts);
+  vector<Draws> draws;
+  draws.reserve(nParts);
+  for(uint p = 0; p < nParts; ++p) {
+    unsigned long const first = ((static_cast<unsigned long>(nPlots) * p) / nParts) * plotSize;
+    unsigned long const end = ((static_cast<unsigned long>(nPlots) * (p+1)) / nParts) * plotSize;
+    uint const n = end - first;
+    streams[p] = com.rng;
+    // individuals picked from the part only
+    draws.push_back(Draws(streams[p], n * mu, n, plotSize));
+    com.rng = streams[p];
+    com.rng.jump();
+  }
   
-  if( metaCom ) {
-    if( PySequence_Check(metaCom) ) {
-      int const n = PySequence_Size(metaCom);
-      if( n > 0 ) {
-	nPlots = n;
+  Barrier barrier(nParts);
+  std::atomic<unsigned long long> nEvents(0);
+  
+  auto part = [&](uint const p) {
+    uint const firstPlot = (static_cast<unsigned long>(nPlots) * p) / nParts;
+    uint const endPlot = (static_cast<unsigned long>(nPlots) * (p+1)) / nParts;
+    unsigned long const first = firstPlot * static_cast<unsigned long>(plotSize);
+    unsigned long const end = endPlot * static_cast<unsigned long>(plotSize);
+    
+    Draws& draw = draws[p];
+    uint nSpeciations = 0;
+    unsigned long long nPartEvents = 0;
+    
+    for(double t0 = startTime; t0 < targetTime; ) {
+      double const t1 = std::min(t0 + epoch, targetTime);
+      // waiting times are memoryless, so events past the epoch end are
+      // simply dropped
+      for(double t = t0 + draw.timeToNextDeath(); t <= t1; t += draw.timeToNextDeath()) {
+	unsigned long const k = first + draw.pickGlobIndividual();
+	double const x = draw.zeroOne();
+	uint sx;
+	if( x < pLocal ) {
+	  unsigned long const np = k / plotSize;
+	  sx = live[np * plotSize + draw.pickLocalIndividual()];
+	} else if( x < pLocalOrImi ) {
+	  unsigned long const k1 = dispersal ?
+	    dispersal->source(k / plotSize, draw) * static_cast<unsigned long>(plotSize)
+	    + draw.pickLocalIndividual() : draw.below(nIndividuals);
+	  sx = (first <= k1 && k1 < end) ? live[k1] : snap[k1];
+	} else {
+	  sx = lastSpecies + 1 + p + nSpeciations * nParts;
+	  ++nSpeciations;
+	}
+	live[k] = sx;
+	++nPartEvents;
+      }
+      t0 = t1;
+      
+      barrier.wait();
+      std::copy(live.begin() + first, live.begin() + end, snap.begin() + first);
+      barrier.wait();
+    }
+    nEvents += nPartEvents;
+  };
 
-	bool err = false;
-	for(uint k = 0; k < nPlots; ++k) {
-	  PyObject* const pk = PySequence_Fast_GET_ITEM(metaCom, k);
-	  if( ! PySequence_Check(pk) ) {
-	    err = true;
-	    break;
+  {
+    // parts wait on each other, so none runs until all have started
+    StartGate gate;
+    auto startPart = [&](uint const p) {
+      if( gate.wait() ) {
+	part(p);
+      }
+    };
+    vector<std::thread> pool;
+    pool.reserve(nParts);
+    try {
+      for(uint p = 1; p < nParts; ++p) {
+	pool.push_back(std::thread(startPart, p));
+      }
+    } catch (std::system_error&) {
+      gate.open(false);
+      for(auto t = pool.begin(); t != pool.end(); ++t) {
+	t->join();
+      }
+      throw;
+    }
+    gate.open(true);
+    part(0);
+    for(auto t = pool.begin(); t != pool.end(); ++t) {
+      t->join();
+    }
+  }
+  
+  for(uint np = 0; np < nPlots; ++np) {
+    for(uint ni = 0; ni < plotSize; ++ni) {
+      uint const s = live[np * plotSize + ni];
+      if( s != com.species(np, ni) ) {
+	com.setSpecies(np, ni, s);
+      }
+    }
+  }
+  com.countEvents(nEvents);
+  // numbers skipped by the parts are free as well
+  if( com.recyclesSpecies() ) {
+    com.recount();
+  }
+  double const endTime = std::max(startTime, targetTime);
+  com.setTime(endTime);
+  return endTime;
+}
+
+// Species and its number of individuals in a plot. 'end' is the running
+// total of counts up to and including this species.
+struct Abundance {
+  uint species;
+  uint count;
+  uint end;
+};
+
+typedef vector<Abundance> PlotAbundance;
+
+// Split n individuals drawn (with replacement) from a plot of 'tot'
+// individuals between its species, calling add(species, k) for each species
+// drawn k > 0 times. Individuals are picked one by one when there are fewer
+// of them than species, otherwise there is one binomial draw per species.
+template<typename Add>
+static void
+splitDraws(uint const n, PlotAbundance const& a, uint const tot, StdDraws& draw,
+	   Randomizer& rng, Add add)
+{
+  if( n < a.size() ) {
+    for(uint j = 0; j < n; ++j) {
+      uint const x = draw.below(tot);
+      auto const i = std::upper_bound(a.begin(), a.end(), x,
+				      [](uint x, Abundance const& e) { return x < e.end; });
+      add(i->species, 1);
+    }
+    return;
+  }
+  uint left = n, rest = tot;
+  for(auto i = a.begin(); left > 0 && i != a.end(); ++i) {
+    uint const k = i->count >= rest ? left :
+      std::binomial_distribution<uint>(left, i->count / double(rest))(rng);
+    if( k > 0 ) {
+      add(i->species, k);
+    }
+    left -= k;
+    rest -= i->count;
+  }
+}
+
+// Write species counts back to the individuals of the community, keeping
+// as many individuals as possible. 'want' is all zeros and covers all
+// species numbers, and is left so.
+static void
+writeBack(MetaCommunity& com, vector<PlotAbundance> const& plots, vector<uint>& want)
+{
+  vector<uint> open;
+  for(uint np = 0; np < com.nPlots; ++np) {
+    for(auto e = plots[np].begin(); e != plots[np].end(); ++e) {
+      want[e->species] = e->count;
+    }
+    open.clear();
+    for(uint ni = 0; ni < com.plotSize; ++ni) {
+      uint const s = com.species(np, ni);
+      if( s < want.size() && want[s] > 0 ) {
+	--want[s];
+      } else {
+	open.push_back(ni);
+      }
+    }
+    auto o = open.begin();
+    for(auto e = plots[np].begin(); e != plots[np].end(); ++e) {
+      for(; want[e->species] > 0; --want[e->species]) {
+	com.setSpecies(np, *o++, e->species);
+      }
+    }
+    assert( o == open.end() );
+  }
+}
+
+double
+MetaSimulator::leap(double const targetTime, MetaCommunity& com, double const tau,
+		    LeapStats& st, SampleRecorder* const rec)
+{
+  uint const nPlots = com.nPlots;
+  uint const plotSize = com.plotSize;
+  Randomizer& rng = com.rng;
+  StdDraws draw(rng, 1, com.nIndividuals(), plotSize);
+
+  double const pImi = (1 - pLocal) > 0 ? std::min((pLocalOrImi - pLocal) / (1 - pLocal), 1.0) : 0;
+  
+  uint nextNew = com.getLastSpecies() + 1;
+  // species number to (1 + position) in the plot being built, also used
+  // for writing back
+  vector<uint> where(nextNew, 0);
+  
+  vector<PlotAbundance> cur(nPlots), nxt(nPlots);
+  for(uint np = 0; np < nPlots; ++np) {
+    for(uint ni = 0; ni < plotSize; ++ni) {
+      uint const s = com.species(np, ni);
+      if( where[s] == 0 ) {
+	Abundance const a = {s, 0, 0};
+	cur[np].push_back(a);
+	where[s] = cur[np].size();
+      }
+      ++cur[np][where[s]-1].count;
+    }
+    for(auto e = cur[np].begin(); e != cur[np].end(); ++e) {
+      where[e->species] = 0;
+    }
+  }
+
+  double t = com.getTime();
+  // steps end on a grid from the start time, so no time is lost to rounding
+  double const startTime = t;
+  unsigned long nGrid = 1;
+  double nextSample = rec ? rec->next() : HUGE_VAL;
+  bool written = true;
+  unsigned long long nEvents = 0;
+  
+  while( true ) {
+    if( nextSample <= t ) {
+      if( ! written ) {
+	writeBack(com, cur, where);
+	written = true;
+      }
+      rec->recordThrough(t, com);
+      nextSample = rec->next();
+      continue;
+    }
+    if( t >= targetTime ) {
+      break;
+    }
+    double const gridEnd = startTime + nGrid * tau;
+    double const t1 = std::min(std::min(gridEnd, targetTime), nextSample);
+    if( t1 == gridEnd ) {
+      ++nGrid;
+    }
+    double const meanDeaths = plotSize * mu * (t1 - t);
+    
+    for(uint np = 0; np < nPlots; ++np) {
+      PlotAbundance& a = cur[np];
+      uint tot = 0;
+      for(auto e = a.begin(); e != a.end(); ++e) {
+	e->end = (tot += e->count);
+      }
+    }
+    
+    for(uint np = 0; np < nPlots; ++np) {
+      PlotAbundance const& a = cur[np];
+      PlotAbundance& b = nxt[np];
+      b = a;
+      
+      uint d = meanDeaths > 0 ? std::poisson_distribution<uint>(meanDeaths)(rng) : 0;
+      if( d > plotSize ) {
+	st.nClipped += d - plotSize;
+	d = plotSize;
+      }
+      nEvents += d;
+      st.maxReplaced = std::max(st.maxReplaced, d / double(plotSize));
+      
+      // deaths, a multinomial kept within each species count
+      {
+	uint left = d, rest = plotSize;
+	for(auto e = b.begin(); left > 0 && e != b.end(); ++e) {
+	  uint const c = e->count;
+	  uint k = c >= rest ? left :
+	    std::binomial_distribution<uint>(left, c / double(rest))(rng);
+	  uint const lo = left > rest - c ? left - (rest - c) : 0;
+	  uint const hi = std::min(c, left);
+	  if( k < lo ) {
+	    st.nClipped += lo - k;
+	    k = lo;
+	  } else if( k > hi ) {
+	    st.nClipped += k - hi;
+	    k = hi;
+	  }
+	  e->count -= k;
+	  left -= k;
+	  rest -= c;
+	}
+      }
+
+      // births: local, immigrant or a new species
+      uint const nLocal = std::binomial_distribution<uint>(d, pLocal)(rng);
+      uint const nImi = std::binomial_distribution<uint>(d - nLocal, pImi)(rng);
+      uint const nNew = d - nLocal - nImi;
+      
+      where.resize(nextNew + nNew, 0);
+      for(uint k = 0; k < b.size(); ++k) {
+	where[b[k].species] = k + 1;
+      }
+      auto add = [&](uint const s, uint const k) {
+	if( where[s] == 0 ) {
+	  Abundance const e = {s, 0, 0};
+	  b.push_back(e);
+	  where[s] = b.size();
+	}
+	b[where[s]-1].count += k;
+      };
+      
+      splitDraws(nLocal, a, plotSize, draw, rng, add);
+      
+      if( dispersal ) {
+	for(uint j = 0; j < nImi; ++j) {
+	  splitDraws(1, cur[dispersal->source(np, draw)], plotSize, draw, rng, add);
+	}
+      } else if( nImi < nPlots ) {
+	for(uint j = 0; j < nImi; ++j) {
+	  splitDraws(1, cur[draw.below(nPlots)], plotSize, draw, rng, add);
+	}
+      } else {
+	// all plots are the same size, so a uniform individual of the
+	// community is an individual of a uniform plot
+	uint left = nImi;
+	for(uint q = 0; left > 0 && q < nPlots; ++q) {
+	  uint const k = q + 1 == nPlots ? left :
+	    std::binomial_distribution<uint>(left, 1.0 / (nPlots - q))(rng);
+	  splitDraws(k, cur[q], plotSize, draw, rng, add);
+	  left -= k;
+	}
+      }
+      
+      for(uint j = 0; j < nNew; ++j) {
+	add(nextNew++, 1);
+      }
+
+      for(auto e = b.begin(); e != b.end(); ++e) {
+	where[e->species] = 0;
+      }
+      b.erase(std::remove_if(b.begin(), b.end(),
+			     [](Abundance const& e) { return e.count == 0; }), b.end());
+    }
+    std::swap(cur, nxt);
+    written = false;
+    ++st.nSteps;
+    t = t1;
+  }
+
+  if( ! written ) {
+    writeBack(com, cur, where);
+  }
+  if( com.recyclesSpecies() ) {
+    com.recount();
+  }
+  st.nEvents += nEvents;
+  com.countEvents(nEvents);
+  com.setTime(t);
+  return t;
+}
+
+// A sampled lineage going back in time.
+struct Lineage {
+  // genealogy node at the bottom of the current branch
+  uint	node;
+  uint	plot;
+  // position in the plot list of lineages
+  uint	inPlot;
+  // true once a speciation was seen on the current branch. Only the first
+  // (most recent) one matters for the species of the descendants.
+  bool	speciated;
+};
+
+// Going back in time, the individual carrying a lineage was born at rate mu.
+// Its parent is a random individual of the same plot with probability pLocal,
+// otherwise a random individual of the whole community (with a new species
+// at rate lam, an immigrant at rate rho). A parent which carries another
+// sampled lineage is a coalescence, any other parent just moves the lineage.
+// Only events which coalesce lineages or move them between plots are
+// simulated, so the work is proportional to the sample and not the
+// community.
+bool
+MetaSimulator::sampleGenealogy(uint const nPlots, uint const plotSize,
+			       vector<uint> const& sample,
+			       Randomizer& rng, SampleGenealogy& g) const
+{
+  unsigned long const nIndividuals = static_cast<unsigned long>(nPlots) * plotSize;
+  
+  vector<Lineage> lins;
+  // lineages (indices into lins) in each plot
+  vector< vector<uint> > inPlot(nPlots);
+  // species boundary at the top of node's branch (0 if none)
+  vector<uint> specAbove;
+  uint nSpecies = 0;
+  
+  for(uint np = 0; np < nPlots; ++np) {
+    for(uint k = 0; k < sample[np]; ++k) {
+      Lineage l = {g.add(-1, 0, np), np, static_cast<uint>(inPlot[np].size()), false};
+      inPlot[np].push_back(lins.size());
+      lins.push_back(l);
+      specAbove.push_back(0);
+    }
+  }
+
+  // plots holding two or more lineages, and sum of m(m-1) over them
+  // (m number of lineages in plot).
+  double pairs = 0;
+  for(uint np = 0; np < nPlots; ++np) {
+    double const m = inPlot[np].size();
+    pairs += m * (m-1);
+  }
+
+  double const localRate = mu * pLocal / plotSize;
+  double const globalRate = lam + rho;
+  double t = 0;
+
+  std::uniform_real_distribution<double> zeroOne(0.0, 1.0);
+  std::uniform_int_distribution<unsigned long> pickGlobIndividual(0, nIndividuals-1);
+
+  // remove lineage l from its plot
+  auto leavePlot = [&](uint const l) {
+    vector<uint>& ps = inPlot[lins[l].plot];
+    double const m = ps.size();
+    pairs -= 2*(m-1);
+    uint const last = ps.back();
+    ps[lins[l].inPlot] = last;
+    lins[last].inPlot = lins[l].inPlot;
+    ps.pop_back();
+  };
+
+  auto enterPlot = [&](uint const l, uint const np) {
+    vector<uint>& ps = inPlot[np];
+    pairs += 2*ps.size();
+    lins[l].plot = np;
+    lins[l].inPlot = ps.size();
+    ps.push_back(l);
+  };
+
+  // lineage l finds its parent carried by lineage o
+  auto coalesce = [&](uint const l, uint const o) {
+    uint const n = g.add(-1, t, lins[o].plot);
+    specAbove.push_back(0);
+    g.parent[lins[l].node] = n;
+    g.parent[lins[o].node] = n;
+    lins[o].node = n;
+    lins[o].speciated = false;
+    
+    leavePlot(l);
+    uint const last = lins.size() - 1;
+    if( l != last ) {
+      lins[l] = lins[last];
+      inPlot[lins[l].plot][lins[l].inPlot] = l;
+    }
+    lins.pop_back();
+  };
+
+  while( lins.size() > 1 ) {
+    double const rLocal = localRate * pairs;
+    double const rGlobal = globalRate * lins.size();
+    double const rate = rLocal + rGlobal;
+    if( rate <= 0 ) {
+      return false;
+    }
+    t += std::exponential_distribution<double>(rate)(rng);
+    
+    double const u = zeroOne(rng) * rate;
+    if( u < rLocal ) {
+      // pick a plot by number of ordered pairs, then a pair in it
+      double x = zeroOne(rng) * pairs;
+      uint np = 0;
+      for(/**/; np < nPlots; ++np) {
+	double const m = inPlot[np].size();
+	x -= m * (m-1);
+	if( x < 0 && m > 1 ) {
+	  break;
+	}
+      }
+      np = std::min(np, nPlots-1);
+      vector<uint> const& ps = inPlot[np];
+      uint const m = ps.size();                  assert( m > 1 );
+      uint const i = std::uniform_int_distribution<uint>(0, m-1)(rng);
+      uint j = std::uniform_int_distribution<uint>(0, m-2)(rng);
+      j += (j >= i);
+      coalesce(ps[i], ps[j]);
+    } else {
+      uint const l = std::uniform_int_distribution<uint>(0, lins.size()-1)(rng);
+      if( zeroOne(rng) * globalRate < lam && ! lins[l].speciated ) {
+	specAbove[lins[l].node] = ++nSpecies;
+	lins[l].speciated = true;
+      }
+      unsigned long const k = pickGlobIndividual(rng);
+      uint const np = k / plotSize;
+      uint const ni = k - static_cast<unsigned long>(np) * plotSize;
+      // first m individuals of a plot stand for its m lineages
+      if( ni < inPlot[np].size() ) {
+	uint const o = inPlot[np][ni];
+	if( o != l ) {
+	  coalesce(l, o);
+	}
+      } else if( np != lins[l].plot ) {
+	leavePlot(l);
+	enterPlot(l, np);
+      }
+    }
+  }
+
+  // Species of root lineage is the one of the next speciation above it
+  uint const root = lins[0].node;
+  if( ! specAbove[root] ) {
+    specAbove[root] = ++nSpecies;
+  }
+  
+  uint const nNodes = g.parent.size();
+  g.species.resize(nNodes);
+  for(uint n = nNodes; n > 0; --n) {
+    uint const x = n-1;
+    g.species[x] = specAbove[x] ? specAbove[x] : g.species[g.parent[x]];
+  }
+  return true;
+}
+
+static void
+metaDestructor(PyObject* const o)
+{
+  if( PyCapsule_IsValid(o, "TMC") ) {
+    void* c = PyCapsule_GetPointer(o, "TMC");
+    delete reinterpret_cast<TracedMetaCommunity*>(c);
+  } else if( PyCapsule_IsValid(o, "MC") ) {
+    void* c = PyCapsule_GetPointer(o, "MC");
+    delete reinterpret_cast<MetaCommunity*>(c);
+  }
+}
+
+// Community (traced or not) held by capsule, 0 if not a community
+static MetaCommunity*
+getCommunity(PyObject* const o)
+{
+  if( PyCapsule_IsValid(o, "TMC") ) {
+    return reinterpret_cast<TracedMetaCommunity*>(PyCapsule_GetPointer(o, "TMC"));
+  }
+  if( PyCapsule_IsValid(o, "MC") ) {
+    return reinterpret_cast<MetaCommunity*>(PyCapsule_GetPointer(o, "MC"));
+  }
+  return 0;
+}
+
+// Marks a community in use for the duration of a call. Threaded
+// forwardSimulation, optTraces and saveCommunity run without the GIL, so
+// another python thread may call in meanwhile: calls only reading the
+// community may overlap, but a call changing it can not overlap any other,
+// and raises ValueError instead.
+class CommunityUse {
+public:
+  CommunityUse(MetaCommunity* _c, bool _write) :
+    c(_c),
+    write(_write),
+    held(write ? c->busy == 0 : c->busy >= 0)
+    {
+      if( ! held ) {
+	PyErr_SetString(PyExc_ValueError, "community in use by another thread.");
+      } else if( write ) {
+	c->busy = -1;
+      } else {
+	++c->busy;
+      }
+    }
+
+  ~CommunityUse() {
+    if( held ) {
+      c->busy = write ? 0 : c->busy - 1;
+    }
+  }
+
+  // false, with a python error set, when the community is in use by a
+  // conflicting call
+  bool ok(void) const { return held; }
+  
+private:
+  MetaCommunity* const c;
+  bool const	       write;
+  bool const	       held;
+};
+
+static PyObject*
+randomStateAsPyObject(Randomizer const& rng)
+{
+  PyObject* const o = PyTuple_New(4);
+  for(uint k = 0; k < 4; ++k) {
+    PyTuple_SET_ITEM(o, k, PyLong_FromUnsignedLongLong(rng.s[k]));
+  }
+  return o;
+}
+
+static bool
+randomStateFromPyObject(PyObject* const o, Randomizer& rng)
+{
+  if( ! (PySequence_Check(o) && PySequence_Size(o) == 4) ) {
+    return false;
+  }
+  uint64_t s[4];
+  for(uint k = 0; k < 4; ++k) {
+    PyObject* const sk = PySequence_GetItem(o, k);
+    s[k] = PyInt_AsUnsignedLongLongMask(sk);
+    Py_XDECREF(sk);
+  }
+  if( PyErr_Occurred() || (s[0] | s[1] | s[2] | s[3]) == 0 ) {
+    PyErr_Clear();
+    return false;
+  }
+  std::copy(s, s+4, rng.s);
+  return true;
+}
+
+PyObject*
+newCommunity(PyObject*, PyObject* args, PyObject* kwds)
+{
+  static const char *kwlist[] = {"nPlots", "plotSize", "startTime", "trace", "metaCommunity", 
+				 "seed", "stream", "randomState", "recycleSpecies",
+				 static_cast<const char*>(0)};
+  PyObject* metaCom = 0;
+  double startTime = 0;
+  uint nPlots = 0, plotSize = 0;
+  PyObject* pyTrace = 0;
+  double seed = -1;
+  uint stream = 0;
+  PyObject* randomState = 0;
+  PyObject* pyRecycle = 0;
+  
+  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "|iidOOdIOO", const_cast<char**>(kwlist),
+				    &nPlots,&plotSize,&startTime,&pyTrace,&metaCom,
+				    &seed,&stream,&randomState,&pyRecycle)) {
+    PyErr_SetString(PyExc_ValueError, "wrong args.") ;
+    return 0;
+  }
+  
+  bool const trace = (pyTrace && PyObject_IsTrue(pyTrace));
+
+  Randomizer rng;
+  if( randomState ) {
+    if( ! randomStateFromPyObject(randomState, rng) ) {
+      PyErr_SetString(PyExc_ValueError, "wrong args: invalid random state");
+      return 0;
+    }
+  } else {
+    rng.seed(seed >= 0 ? static_cast<uint64_t>(seed) : seeder(), stream);
+  }
+  
+  MetaCommunity* com = 0;
+  TracedMetaCommunity* tcom = 0;
+  
+  if( metaCom ) {
+    if( PySequence_Check(metaCom) ) {
+      int const n = PySequence_Size(metaCom);
+      if( n > 0 ) {
+	nPlots = n;
+
+	bool err = false;
+	for(uint k = 0; k < nPlots; ++k) {
+	  PyObject* const pk = PySequence_Fast_GET_ITEM(metaCom, k);
+	  if( ! PySequence_Check(pk) ) {
+	    err = true;
+	    break;
 	  }
 	  if( k == 0 ) {
 	    plotSize = PySequence_Size(pk);
@@ -684,95 +2661,1009 @@ newCommunity(PyObject*, PyObject* args, PyObject* kwds)
       }
     }
 
-    if( (trace && !tcom) || (!trace && !com) ) {
-      PyErr_SetString(PyExc_ValueError, "wrong args: not a valid community");
-      return 0;
-    }
-	
-  } else {
-    if( nPlots == 0 || plotSize == 0 ) {
-      PyErr_SetString(PyExc_ValueError, "wrong args: no community or valid sizes");
-      return 0;
-    }
-    if( trace ) {
-      tcom = new TracedMetaCommunity(nPlots, plotSize, startTime);
-    } else {
-      com = new MetaCommunity(nPlots, plotSize, startTime);
-    }
+    if( (trace && !tcom) || (!trace && !com) ) {
+      PyErr_SetString(PyExc_ValueError, "wrong args: not a valid community");
+      return 0;
+    }
+	
+  } else {
+    if( nPlots == 0 || plotSize == 0 ) {
+      PyErr_SetString(PyExc_ValueError, "wrong args: no community or valid sizes");
+      return 0;
+    }
+    if( trace ) {
+      tcom = new TracedMetaCommunity(nPlots, plotSize, startTime);
+    } else {
+      com = new MetaCommunity(nPlots, plotSize, startTime);
+    }
+  }
+
+  if( trace ) {
+    tcom->rng = rng;
+  } else {
+    com->rng = rng;
+  }
+  if( pyRecycle && PyObject_IsTrue(pyRecycle) ) {
+    (trace ? tcom : com)->setRecycleSpecies(true);
+  }
+  
+  void* c = trace ? tcom : com;
+  PyObject* o = PyCapsule_New(c, trace ? "TMC" : "MC", metaDestructor);
+  return o;
+}
+
+// Sample times in (startTime, targetTime], sorted. False if not a sequence
+// of numbers.
+static bool
+sampleTimesFromPyObject(PyObject* const o, double const startTime, double const targetTime,
+			vector<double>& times)
+{
+  if( ! PySequence_Check(o) ) {
+    return false;
+  }
+  int const n = PySequence_Size(o);
+  for(int k = 0; k < n; ++k) {
+    PyObject* const tk = PySequence_GetItem(o, k);
+    double const t = tk ? PyFloat_AsDouble(tk) : -1;
+    Py_XDECREF(tk);
+    if( PyErr_Occurred() ) {
+      PyErr_Clear();
+      return false;
+    }
+    if( startTime < t && t <= targetTime ) {
+      times.push_back(t);
+    }
+  }
+  std::sort(times.begin(), times.end());
+  return true;
+}
+
+// Dispersal from a nPlots x nPlots matrix of weights, where row np holds the
+// weights of the source plots of immigrants into np.
+static bool
+dispersalFromMatrix(PyObject* const o, Dispersal& d)
+{
+  uint const nPlots = d.nPlots();
+  if( ! (PySequence_Check(o) && static_cast<uint>(PySequence_Size(o)) == nPlots) ) {
+    return false;
+  }
+  vector<uint> plots(nPlots);
+  for(uint np = 0; np < nPlots; ++np) {
+    plots[np] = np;
+  }
+  vector<double> w(nPlots);
+  bool ok = true;
+  for(uint np = 0; ok && np < nPlots; ++np) {
+    PyObject* const row = PySequence_GetItem(o, np);
+    ok = row && PySequence_Check(row) && static_cast<uint>(PySequence_Size(row)) == nPlots;
+    for(uint j = 0; ok && j < nPlots; ++j) {
+      PyObject* const x = PySequence_GetItem(row, j);
+      w[j] = x ? PyFloat_AsDouble(x) : -1;
+      Py_XDECREF(x);
+      ok = ! PyErr_Occurred();
+    }
+    Py_XDECREF(row);
+    ok = ok && d.setSources(np, plots, w);
+  }
+  PyErr_Clear();
+  return ok;
+}
+
+// Dispersal from plot positions (points of any dimension) by the kernel
+// exp(-distance/scale), truncated beyond 'cutoff' so that sources of a plot
+// are its neighbourhood only. Immigrants may come from the plot itself.
+static bool
+dispersalFromPositions(PyObject* const o, double const scale, double const cutoff,
+		       Dispersal& d)
+{
+  uint const nPlots = d.nPlots();
+  if( ! (PySequence_Check(o) && static_cast<uint>(PySequence_Size(o)) == nPlots) ||
+      scale <= 0 || cutoff < 0 ) {
+    return false;
+  }
+  uint dim = 0;
+  vector<double> xs;
+  bool ok = true;
+  for(uint np = 0; ok && np < nPlots; ++np) {
+    PyObject* const pos = PySequence_GetItem(o, np);
+    ok = pos && PySequence_Check(pos);
+    if( ok ) {
+      uint const n = PySequence_Size(pos);
+      if( np == 0 ) {
+	dim = n;
+      }
+      ok = n == dim && dim > 0;
+      for(uint i = 0; ok && i < dim; ++i) {
+	PyObject* const x = PySequence_GetItem(pos, i);
+	xs.push_back(x ? PyFloat_AsDouble(x) : 0);
+	Py_XDECREF(x);
+	ok = ! PyErr_Occurred();
+      }
+    }
+    Py_XDECREF(pos);
+  }
+  PyErr_Clear();
+  
+  vector<uint> plots;
+  vector<double> w;
+  for(uint np = 0; ok && np < nPlots; ++np) {
+    plots.clear();
+    w.clear();
+    const double* const x = &xs[np * dim];
+    for(uint j = 0; j < nPlots; ++j) {
+      const double* const y = &xs[j * dim];
+      double d2 = 0;
+      for(uint i = 0; i < dim; ++i) {
+	d2 += (x[i] - y[i]) * (x[i] - y[i]);
+      }
+      if( d2 <= cutoff * cutoff ) {
+	plots.push_back(j);
+	w.push_back(exp(-sqrt(d2) / scale));
+      }
+    }
+    ok = d.setSources(np, plots, w);
+  }
+  return ok;
+}
+
+PyObject*
+forwardSim(PyObject*, PyObject* args, PyObject* kwds)
+{
+  static const char *kwlist[] = {"metaCommunity","targetTime", "mu", "lam", "rho", 
+				 "minCAtime", "seed", "cleanEvery", "stats", "sampleTimes",
+				 "snapshots", "batchRandom", "nThreads", "epoch",
+				 "dispersal", "positions", "kernelScale", "kernelCutoff",
+				 "leap",
+				 static_cast<const char*>(0)};
+  PyObject* metaCom = 0;
+  double targetTime;
+  double minCAtime = -1;
+  double cleanEvery = 1;
+  double mu = 1, lam = 1, rho = 1;
+  double seed = -1;
+  PyObject* pyStats = 0;
+  PyObject* pySampleTimes = 0;
+  PyObject* pySnapshots = 0;
+  PyObject* pyBatchRandom = 0;
+  int nThreads = 1;
+  double epoch = -1;
+  PyObject* pyDispersal = 0;
+  PyObject* pyPositions = 0;
+  double kernelScale = 1;
+  double kernelCutoff = -1;
+  PyObject* pyLeap = 0;
+  
+  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "Odddd|dddOOOOidOOddO", const_cast<char**>(kwlist),
+				    &metaCom,&targetTime,&mu,&lam,&rho,&minCAtime,&seed,
+				    &cleanEvery,&pyStats,&pySampleTimes,&pySnapshots,
+				    &pyBatchRandom,&nThreads,&epoch,
+				    &pyDispersal,&pyPositions,&kernelScale,&kernelCutoff,
+				    &pyLeap)) {
+    PyErr_SetString(PyExc_ValueError, "wrong args.") ;
+    return 0;
+  }
+
+  MetaCommunity* const c = getCommunity(metaCom);
+  if( ! c ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: not a valid community") ;
+    return 0;
+  }
+  TracedMetaCommunity* const tcom = PyCapsule_IsValid(metaCom, "TMC") ?
+    static_cast<TracedMetaCommunity*>(c) : 0;
+  CommunityUse const use(c, true);
+  if( ! use.ok() ) {
+    return 0;
+  }
+  
+  // In stats (snapshots) mode abundance summaries (species of all
+  // individuals) at each sample time and at the target time are returned
+  // instead of the community.
+  bool const stats = (pyStats && PyObject_IsTrue(pyStats));
+  bool const snapshots = (pySnapshots && PyObject_IsTrue(pySnapshots));
+  vector<double> times;
+  if( pySampleTimes && pySampleTimes != Py_None ) {
+    if( ! (stats || snapshots) ) {
+      PyErr_SetString(PyExc_ValueError, "wrong args: sample times require stats or snapshots");
+      return 0;
+    }
+    if( ! sampleTimesFromPyObject(pySampleTimes, c->getTime(), targetTime, times) ) {
+      PyErr_SetString(PyExc_ValueError, "wrong args: sample times not a sequence of numbers");
+      return 0;
+    }
+  }
+  if( times.empty() || times.back() < targetTime ) {
+    times.push_back(targetTime);
+  }
+  
+  if( seed >= 0 ) {
+    c->rng.seed(seed);
+  }
+  
+  bool const batchRandom = ! pyBatchRandom || PyObject_IsTrue(pyBatchRandom);
+  MetaSimulator s(mu, lam, rho, batchRandom);
+
+  // Source plots of immigrants, uniform over the whole community by default
+  Dispersal dispersal(pyDispersal || pyPositions ? c->nPlots : 0);
+  if( pyDispersal && pyPositions ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: either dispersal matrix or positions");
+    return 0;
+  }
+  if( pyDispersal ) {
+    if( ! dispersalFromMatrix(pyDispersal, dispersal) ) {
+      PyErr_SetString(PyExc_ValueError, "wrong args: dispersal not a nPlots x nPlots matrix"
+		      " with a positive weight in each row");
+      return 0;
+    }
+    s.setDispersal(&dispersal);
+  } else if( pyPositions ) {
+    if( kernelCutoff < 0 ) {
+      kernelCutoff = 5 * kernelScale;
+    }
+    if( ! dispersalFromPositions(pyPositions, kernelScale, kernelCutoff, dispersal) ) {
+      PyErr_SetString(PyExc_ValueError, "wrong args: invalid plot positions or kernel");
+      return 0;
+    }
+    s.setDispersal(&dispersal);
+  }
+  
+  // Approximate tau leaping run, in steps of 'leap'
+  double leap = -1;
+  if( pyLeap && pyLeap != Py_None ) {
+    leap = PyFloat_AsDouble(pyLeap);
+    if( PyErr_Occurred() || !(leap > 0) ) {
+      PyErr_Clear();
+      PyErr_SetString(PyExc_ValueError, "wrong args: leap step not a positive number");
+      return 0;
+    }
+    if( tcom || nThreads != 1 ) {
+      PyErr_SetString(PyExc_ValueError, "wrong args: leaping only for untraced communities"
+		      " in a single thread");
+      return 0;
+    }
+    // draws are always from the community stream, and there are no traces
+    if( pyBatchRandom || minCAtime >= 0 || cleanEvery != 1 ) {
+      PyErr_SetString(PyExc_ValueError, "wrong args: batchRandom, minCAtime and cleanEvery"
+		      " do not apply to leaping");
+      return 0;
+    }
+  }
+  
+  if( leap <= 0 && nThreads != 1 ) {
+    // plots split between threads
+    if( tcom || snapshots || (pySampleTimes && pySampleTimes != Py_None) ) {
+      PyErr_SetString(PyExc_ValueError, "wrong args: threads only for untraced communities"
+		      " without samples");
+      return 0;
+    }
+    if( nThreads <= 0 ) {
+      nThreads = std::max(std::thread::hardware_concurrency(), 1U);
+    }
+    if( epoch <= 0 ) {
+      epoch = 0.01 / mu;
+    }
+    double const t0 = c->getTime();
+    if( t0 + epoch == t0 || targetTime + epoch == targetTime ) {
+      PyErr_SetString(PyExc_ValueError, "wrong args: epoch too small for the simulation times");
+      return 0;
+    }
+  }
+  
+  // abundance is maintained on every event while tracked, so only in stats mode
+  c->trackAbundance(stats);
+  
+  double endTime = c->getTime();
+  PyObject* retVal = 0;
+  PyObject* leapDiag = 0;
+  
+  if( leap > 0 ) {
+    LeapStats st;
+    if( stats || snapshots ) {
+      SampleRecorder rec(times, stats, snapshots);
+      endTime = s.leap(targetTime, *c, leap, st, &rec);
+      retVal = rec.asPyObject();
+    } else {
+      endTime = s.leap(targetTime, *c, leap, st);
+      retVal = c->asPyObject();
+    }
+    leapDiag = Py_BuildValue("kKdK", st.nSteps, st.nEvents, st.maxReplaced, st.nClipped);
+  } else if( nThreads != 1 ) {
+    // 0 when done, otherwise the exception to raise
+    PyObject* failed = 0;
+    Py_BEGIN_ALLOW_THREADS
+    try {
+      endTime = s.advance(targetTime, *c, nThreads, epoch);
+    } catch (std::bad_alloc&) {
+      failed = PyExc_MemoryError;
+    } catch (std::system_error&) {
+      failed = PyExc_RuntimeError;
+    }
+    Py_END_ALLOW_THREADS
+    if( failed ) {
+      PyErr_SetString(failed, failed == PyExc_MemoryError ?
+		      "out of memory while running threads." : "failed to start threads.");
+      return 0;
+    }
+    if( stats ) {
+      vector<AbundanceStats::Summary> sms;
+      c->getAbundance()->summaries(sms);
+      retVal = Py_BuildValue("[N]", AbundanceStats::asPyObject(endTime, sms));
+    } else {
+      retVal = c->asPyObject();
+    }
+  } else if( stats || snapshots ) {
+    SampleRecorder rec(times, stats, snapshots);
+    endTime = tcom ? s.advance(targetTime, *tcom, minCAtime, cleanEvery, &rec) :
+      s.advance(targetTime, *c, &rec);
+    retVal = rec.asPyObject();
+  } else if( tcom ) {
+    endTime = s.advance(targetTime, *tcom, minCAtime, cleanEvery);
+    retVal = tcom->asPyObject();
+  } else {
+    endTime = s.advance(targetTime, *c);
+    retVal = c->asPyObject();
+  }
+
+  PyObject* o = PyTuple_New(leapDiag ? 3 : 2);
+  PyTuple_SET_ITEM(o, 0, PyFloat_FromDouble(endTime));
+  PyTuple_SET_ITEM(o, 1, retVal);
+  if( leapDiag ) {
+    PyTuple_SET_ITEM(o, 2, leapDiag);
+  }
+  return o;
+}
+
+// One independent run of forwardSimBatch. Owns its community and random
+// stream, so replicates can be advanced concurrently.
+struct Replicate {
+  Replicate() : com(0), tcom(0), endTime(-1) {}
+
+  MetaCommunity*	com;
+  TracedMetaCommunity*	tcom;
+  double		endTime;
+};
+
+PyObject*
+forwardSimBatch(PyObject*, PyObject* args, PyObject* kwds)
+{
+  static const char *kwlist[] = {"nReplicates", "nPlots", "plotSize", "targetTime",
+				 "mu", "lam", "rho", "minCAtime", "seed", "cleanEvery",
+				 "trace", "nThreads", "batchRandom",
+				 static_cast<const char*>(0)};
+  int nReplicates = 0;
+  uint nPlots = 0, plotSize = 0;
+  double targetTime;
+  double minCAtime = -1;
+  double cleanEvery = 1;
+  double mu = 1, lam = 1, rho = 1;
+  double seed = -1;
+  PyObject* pyTrace = 0;
+  int nThreads = 0;
+  PyObject* pyBatchRandom = 0;
+
+  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "iiidddd|dddOiO", const_cast<char**>(kwlist),
+				    &nReplicates,&nPlots,&plotSize,&targetTime,
+				    &mu,&lam,&rho,&minCAtime,&seed,&cleanEvery,
+				    &pyTrace,&nThreads,&pyBatchRandom)) {
+    PyErr_SetString(PyExc_ValueError, "wrong args.") ;
+    return 0;
+  }
+
+  if( nReplicates <= 0 || nPlots == 0 || plotSize == 0 ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: no replicates or valid sizes");
+    return 0;
+  }
+
+  bool const trace = (pyTrace && PyObject_IsTrue(pyTrace));
+
+  // Replicate k runs on stream k of the seed, so a batch is reproducible
+  // regardless of the number of threads or the order replicates run in.
+  uint64_t const baseSeed = seed >= 0 ? static_cast<uint64_t>(seed) : seeder();
+
+  vector<Replicate> reps(nReplicates);
+
+  if( nThreads <= 0 ) {
+    nThreads = std::max(std::thread::hardware_concurrency(), 1U);
+  }
+  nThreads = std::min(nThreads, nReplicates);
+
+  bool const batchRandom = ! pyBatchRandom || PyObject_IsTrue(pyBatchRandom);
+  MetaSimulator s(mu, lam, rho, batchRandom);
+  std::atomic<int> next(0);
+  std::atomic<bool> failed(false);
+
+  auto worker = [&]() {
+    for(int k = next++; k < nReplicates && ! failed; k = next++) {
+      Replicate& r = reps[k];
+      try {
+	if( trace ) {
+	  r.tcom = new TracedMetaCommunity(nPlots, plotSize);
+	  r.tcom->rng.seed(baseSeed, k);
+	  r.endTime = s.advance(targetTime, *r.tcom, minCAtime, cleanEvery);
+	} else {
+	  r.com = new MetaCommunity(nPlots, plotSize);
+	  r.com->rng.seed(baseSeed, k);
+	  r.endTime = s.advance(targetTime, *r.com);
+	}
+      } catch (std::bad_alloc&) {
+	failed = true;
+      }
+    }
+  };
+
+  Py_BEGIN_ALLOW_THREADS
+  {
+    vector<std::thread> pool;
+    // workers take replicates as they go, so fewer threads only take longer
+    try {
+      pool.reserve(nThreads);
+      for(int i = 1; i < nThreads; ++i) {
+	pool.push_back(std::thread(worker));
+      }
+    } catch (std::system_error&) {
+    } catch (std::bad_alloc&) {}
+    worker();
+    for(auto t = pool.begin(); t != pool.end(); ++t) {
+      t->join();
+    }
+  }
+  Py_END_ALLOW_THREADS
+
+  PyObject* o = failed ? 0 : PyTuple_New(nReplicates);
+  for(int k = 0; k < nReplicates; ++k) {
+    Replicate& r = reps[k];
+    if( o ) {
+      PyObject* const retVal = trace ? r.tcom->asPyObject() : r.com->asPyObject();
+      PyTuple_SET_ITEM(o, k, Py_BuildValue("dN", r.endTime, retVal));
+    }
+    delete r.tcom;
+    delete r.com;
+  }
+
+  if( ! o ) {
+    PyErr_SetString(PyExc_MemoryError, "out of memory while running replicates.");
+  }
+  return o;
+}
+
+PyObject*
+backwardSim(PyObject*, PyObject* args, PyObject* kwds)
+{
+  static const char *kwlist[] = {"nPlots", "plotSize", "mu", "lam", "rho", "sample",
+				 "seed",
+				 static_cast<const char*>(0)};
+  uint nPlots = 0, plotSize = 0;
+  double mu = 1, lam = 1, rho = 1;
+  PyObject* pySample = 0;
+  double seed = -1;
+  
+  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "iidddO|d", const_cast<char**>(kwlist),
+				    &nPlots,&plotSize,&mu,&lam,&rho,&pySample,&seed)) {
+    PyErr_SetString(PyExc_ValueError, "wrong args.") ;
+    return 0;
+  }
+
+  if( nPlots == 0 || plotSize == 0 || mu <= 0 || lam < 0 || rho < 0 || lam + rho > mu ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: invalid sizes or rates");
+    return 0;
+  }
+  
+  // sample size per plot, either same for all plots or one per plot
+  vector<uint> sample(nPlots, 0);
+  if( PySequence_Check(pySample) ) {
+    if( static_cast<uint>(PySequence_Size(pySample)) != nPlots ) {
+      PyErr_SetString(PyExc_ValueError, "wrong args: sample size for each plot expected");
+      return 0;
+    }
+    for(uint np = 0; np < nPlots; ++np) {
+      PyObject* const o = PySequence_GetItem(pySample, np);
+      sample[np] = std::max(PyInt_AsLong(o), 0L);
+      Py_XDECREF(o);
+    }
+  } else {
+    std::fill(sample.begin(), sample.end(), std::max(PyInt_AsLong(pySample), 0L));
+  }
+  if( PyErr_Occurred() ) {
+    return 0;
+  }
+  
+  unsigned long nSampled = 0;
+  for(uint np = 0; np < nPlots; ++np) {
+    if( sample[np] > plotSize ) {
+      PyErr_SetString(PyExc_ValueError, "wrong args: sample larger than plot");
+      return 0;
+    }
+    nSampled += sample[np];
+  }
+  if( nSampled == 0 ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: empty sample");
+    return 0;
+  }
+
+  Randomizer rng(seed >= 0 ? static_cast<uint64_t>(seed) : seeder());
+  MetaSimulator s(mu, lam, rho);
+  SampleGenealogy g;
+
+  if( ! s.sampleGenealogy(nPlots, plotSize, sample, rng, g) ) {
+    PyErr_SetString(PyExc_ValueError, "sample never coalesces (no migration between plots)");
+    return 0;
+  }
+
+  uint const nNodes = g.parent.size();
+  PyObject* const parents = PyTuple_New(nNodes);
+  PyObject* const ages = PyTuple_New(nNodes);
+  PyObject* const plots = PyTuple_New(nNodes);
+  PyObject* const species = PyTuple_New(nNodes);
+  for(uint n = 0; n < nNodes; ++n) {
+    PyTuple_SET_ITEM(parents, n, PyInt_FromLong(g.parent[n]));
+    PyTuple_SET_ITEM(ages, n, PyFloat_FromDouble(g.age[n]));
+    PyTuple_SET_ITEM(plots, n, PyInt_FromLong(g.plot[n]));
+    PyTuple_SET_ITEM(species, n, PyInt_FromLong(g.species[n]));
+  }
+  return Py_BuildValue("NNNN", parents, ages, plots, species);
+}
+
+PyObject*
+CAcounts(PyObject*, PyObject* args, PyObject* kwds)
+{
+  static const char *kwlist[] = {"metaCommunity", "nwithin", "nbetween", "index",
+				 static_cast<const char*>(0)};
+  PyObject* metaCom = 0;
+  int nwithin = 10, nbetween = 10;
+  PyObject* pyIndex = 0;
+  
+  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "O|iiO", const_cast<char**>(kwlist),
+				    &metaCom,&nwithin,&nbetween,&pyIndex)) {
+    PyErr_SetString(PyExc_ValueError, "wrong args.") ;
+    return 0;
+  }
+
+  if( ! PyCapsule_IsValid(metaCom, "TMC") ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: not a valid community") ;
+    return 0;
+  }
+
+  TracedMetaCommunity& tcom =
+    *reinterpret_cast<TracedMetaCommunity*>(PyCapsule_GetPointer(metaCom, "TMC"));
+
+  CommunityUse const use(&tcom, true);
+  if( ! use.ok() ) {
+    return 0;
+  }
+
+  // With an index each query is O(1) instead of walking both traces
+  std::unique_ptr<TraceIndex> index;
+  if( pyIndex && PyObject_IsTrue(pyIndex) ) {
+    index.reset(new TraceIndex(tcom));
+  }
+  uint const plotSize = tcom.plotSize;
+  auto ca = [&](uint p0, uint i0, uint p1, uint i1) {
+    return index ? index->ca(p0 * plotSize + i0, p1 * plotSize + i1) :
+      tcom.ca(p0, i0, p1, i1);
+  };
+  
+  Randomizer& rng = tcom.rng;
+  std::uniform_int_distribution<int> pickPlot(0, tcom.nPlots-1);
+  std::uniform_int_distribution<int> pickLocalIndividual(0, tcom.plotSize-1);
+
+  PyObject* tup0 = PyTuple_New(nwithin);
+  
+  for(int k = 0; k < nwithin; ++k) {
+    uint const np = pickPlot(rng);
+    uint const j = pickLocalIndividual(rng);
+    uint count = 0;
+    for(uint i = 0; i < tcom.plotSize; ++i) {
+      if( i != j ) {
+	const PatchTrace* const p = ca(np, i, np, j);
+	count += p->pTime > 0;
+      }
+    }
+    PyTuple_SET_ITEM(tup0, k, PyInt_FromLong(count));
+  }
+
+  PyObject* tup1 = PyTuple_New(nbetween);
+  for(int k = 0; k < nbetween; ++k) {
+    uint const np0 = pickPlot(rng);
+    uint np1 = np0;
+    while( np1 == np0 ) {
+      np1 = pickPlot(rng);
+    }
+    uint const j = pickLocalIndividual(rng);
+    uint count = 0;
+    for(uint i = 0; i < tcom.plotSize; ++i) {
+      const PatchTrace* const p = ca(np0, j, np1, i);
+      count += p->pTime > 0;
+    }
+    PyTuple_SET_ITEM(tup1, k, PyInt_FromLong(count));
+  }
+  
+  return Py_BuildValue("NN", tup0, tup1);
+}
+
+PyObject*
+coalescenceTimes(PyObject*, PyObject* args, PyObject* kwds)
+{
+  static const char *kwlist[] = {"metaCommunity", "sample",
+				 static_cast<const char*>(0)};
+  PyObject* metaCom = 0;
+  PyObject* pySample = 0;
+  
+  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "OO", const_cast<char**>(kwlist),
+				    &metaCom,&pySample)) {
+    PyErr_SetString(PyExc_ValueError, "wrong args.") ;
+    return 0;
+  }
+
+  if( ! PyCapsule_IsValid(metaCom, "TMC") ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: not a valid community") ;
+    return 0;
+  }
+
+  TracedMetaCommunity& tcom =
+    *reinterpret_cast<TracedMetaCommunity*>(PyCapsule_GetPointer(metaCom, "TMC"));
+
+  CommunityUse const use(&tcom, false);
+  if( ! use.ok() ) {
+    return 0;
+  }
+
+  // sample of (plot, individual) pairs, any sequences of two numbers
+  vector<unsigned long> sample;
+  bool ok = PySequence_Check(pySample);
+  int const n = ok ? PySequence_Size(pySample) : 0;
+  for(int k = 0; ok && k < n; ++k) {
+    PyObject* const x = PySequence_GetItem(pySample, k);
+    long pi[2] = {-1, -1};
+    ok = x && PySequence_Check(x) && PySequence_Size(x) == 2;
+    for(int i = 0; ok && i < 2; ++i) {
+      PyObject* const y = PySequence_GetItem(x, i);
+      pi[i] = y ? PyInt_AsLong(y) : -1;
+      Py_XDECREF(y);
+      ok = ! PyErr_Occurred();
+    }
+    Py_XDECREF(x);
+    long const np = pi[0], ni = pi[1];
+    ok = ok && 0 <= np && np < tcom.nPlots && 0 <= ni && ni < tcom.plotSize;
+    sample.push_back(np * tcom.plotSize + ni);
+  }
+  if( ! ok ) {
+    PyErr_Clear();
+    PyErr_SetString(PyExc_ValueError, "wrong args: sample not a sequence of (plot, individual)");
+    return 0;
+  }
+
+  TraceIndex const index(tcom);
+  
+  PyObject* m = PyTuple_New(n);
+  for(int i = 0; i < n; ++i) {
+    PyObject* r = PyTuple_New(n);
+    for(int j = 0; j < n; ++j) {
+      PyTuple_SET_ITEM(r, j, PyFloat_FromDouble(index.ca(sample[i], sample[j])->pTime));
+    }
+    PyTuple_SET_ITEM(m, i, r);
+  }
+  return m;
+}
+
+PyObject*
+optTraces(PyObject*, PyObject* args, PyObject* kwds)
+{
+  static const char *kwlist[] = {"metaCommunity", "nThreads",
+				 static_cast<const char*>(0)};
+  PyObject* metaCom = 0;
+  int nThreads = 0;
+  
+  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "O|i", const_cast<char**>(kwlist),
+				    &metaCom, &nThreads)) {
+    PyErr_SetString(PyExc_ValueError, "wrong args.") ;
+    return 0;
+  }
+
+  if( ! PyCapsule_IsValid(metaCom, "TMC") ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: not a valid community") ;
+    return 0;
+  }
+
+  TracedMetaCommunity& tcom =
+    *reinterpret_cast<TracedMetaCommunity*>(PyCapsule_GetPointer(metaCom, "TMC"));
+
+  CommunityUse const use(&tcom, true);
+  if( ! use.ok() ) {
+    return 0;
+  }
+
+  if( nThreads <= 0 ) {
+    nThreads = std::max(std::thread::hardware_concurrency(), 1U);
+  }
+  bool failed = false;
+  Py_BEGIN_ALLOW_THREADS
+  try {
+    tcom.optTraces(nThreads);
+  } catch (std::bad_alloc&) {
+    failed = true;
+  }
+  Py_END_ALLOW_THREADS
+  if( failed ) {
+    PyErr_SetString(PyExc_MemoryError, "out of memory while optimizing traces.");
+    return 0;
+  }
+  
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+// Python view of a community species array through the buffer protocol,
+// shares memory with the community and keeps it alive.
+struct SpeciesBufferObject : PyObject {
+  PyObject* owner;
+};
+
+static int
+SpeciesBuffer_getbuffer(SpeciesBufferObject* self, Py_buffer* view, int flags)
+{
+  if( (flags & PyBUF_WRITABLE) == PyBUF_WRITABLE ) {
+    PyErr_SetString(PyExc_BufferError, "community species are read only.");
+    view->obj = 0;
+    return -1;
   }
+  getCommunity(self->owner)->asBuffer(*view, self);
+  if( (flags & PyBUF_FORMAT) != PyBUF_FORMAT ) {
+    view->format = 0;
+  }
+  if( (flags & PyBUF_STRIDES) != PyBUF_STRIDES ) {
+    view->strides = 0;
+  }
+  if( (flags & PyBUF_ND) != PyBUF_ND ) {
+    view->shape = 0;
+  }
+  return 0;
+}
 
-  void* c = trace ? tcom : com;
-  PyObject* o = PyCapsule_New(c, trace ? "TMC" : "MC", metaDestructor);
-  return o;
+static void
+SpeciesBuffer_dealloc(SpeciesBufferObject* self)
+{
+  Py_XDECREF(self->owner);
+  self->ob_type->tp_free(self);
+}
+
+static PyBufferProcs SpeciesBuffer_as_buffer = {
+  0,				/* bf_getreadbuffer  */
+  0,				/* bf_getwritebuffer */
+  0,				/* bf_getsegcount    */
+  0,				/* bf_getcharbuffer  */
+  (getbufferproc)SpeciesBuffer_getbuffer, /* bf_getbuffer */
+  0,				/* bf_releasebuffer  */
+};
+
+static PyTypeObject SpeciesBufferType = {
+  PyObject_HEAD_INIT(NULL)
+  0,				/* ob_size        */
+  "neutralsim.SpeciesBuffer",	/* tp_name        */
+  sizeof(SpeciesBufferObject),	/* tp_basicsize   */
+  0,				/* tp_itemsize    */
+  (destructor)SpeciesBuffer_dealloc, /* tp_dealloc */
+  0,				/* tp_print       */
+  0,				/* tp_getattr     */
+  0,				/* tp_setattr     */
+  0,				/* tp_compare     */
+  0,				/* tp_repr        */
+  0,				/* tp_as_number   */
+  0,				/* tp_as_sequence */
+  0,				/* tp_as_mapping  */
+  0,				/* tp_hash        */
+  0,				/* tp_call        */
+  0,				/* tp_str         */
+  0,				/* tp_getattro    */
+  0,				/* tp_setattro    */
+  &SpeciesBuffer_as_buffer,	/* tp_as_buffer   */
+  Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_NEWBUFFER, /* tp_flags */
+  "Community species buffer.",	/* tp_doc         */
+};
+
+// A one dimensional array of numbers owned by Python, exposed through the
+// buffer protocol (numpy.asarray of its memoryview does not copy).
+struct ArrayObject : PyObject {
+  char*		data;
+  Py_ssize_t	len;
+  Py_ssize_t	itemsize;
+  Py_ssize_t	shape[1];
+  Py_ssize_t	strides[1];
+  const char*	format;
+};
+
+static int
+Array_getbuffer(ArrayObject* self, Py_buffer* view, int flags)
+{
+  if( (flags & PyBUF_WRITABLE) == PyBUF_WRITABLE ) {
+    PyErr_SetString(PyExc_BufferError, "array is read only.");
+    view->obj = 0;
+    return -1;
+  }
+  view->buf = self->data;
+  view->obj = self;
+  Py_INCREF(self);
+  view->len = self->len * self->itemsize;
+  view->readonly = 1;
+  view->itemsize = self->itemsize;
+  view->format = (flags & PyBUF_FORMAT) == PyBUF_FORMAT ? const_cast<char*>(self->format) : 0;
+  view->ndim = 1;
+  view->shape = (flags & PyBUF_ND) == PyBUF_ND ? self->shape : 0;
+  view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? self->strides : 0;
+  view->suboffsets = 0;
+  view->internal = 0;
+  return 0;
+}
+
+static void
+Array_dealloc(ArrayObject* self)
+{
+  delete [] self->data;
+  self->ob_type->tp_free(self);
+}
+
+static PyBufferProcs Array_as_buffer = {
+  0,				/* bf_getreadbuffer  */
+  0,				/* bf_getwritebuffer */
+  0,				/* bf_getsegcount    */
+  0,				/* bf_getcharbuffer  */
+  (getbufferproc)Array_getbuffer, /* bf_getbuffer */
+  0,				/* bf_releasebuffer  */
+};
+
+static PyTypeObject ArrayType = {
+  PyObject_HEAD_INIT(NULL)
+  0,				/* ob_size        */
+  "neutralsim.Array",		/* tp_name        */
+  sizeof(ArrayObject),		/* tp_basicsize   */
+  0,				/* tp_itemsize    */
+  (destructor)Array_dealloc,	/* tp_dealloc     */
+  0,				/* tp_print       */
+  0,				/* tp_getattr     */
+  0,				/* tp_setattr     */
+  0,				/* tp_compare     */
+  0,				/* tp_repr        */
+  0,				/* tp_as_number   */
+  0,				/* tp_as_sequence */
+  0,				/* tp_as_mapping  */
+  0,				/* tp_hash        */
+  0,				/* tp_call        */
+  0,				/* tp_str         */
+  0,				/* tp_getattro    */
+  0,				/* tp_setattro    */
+  &Array_as_buffer,		/* tp_as_buffer   */
+  Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_NEWBUFFER, /* tp_flags */
+  "Array of numbers.",		/* tp_doc         */
+};
+
+// Memoryview of a copy of v. 'format' is the struct code of T.
+template<typename T>
+static PyObject*
+arrayView(vector<T> const& v, const char* format)
+{
+  ArrayObject* const a = PyObject_New(ArrayObject, &ArrayType);
+  if( ! a ) {
+    return 0;
+  }
+  a->data = new char [std::max(v.size(), size_t(1)) * sizeof(T)];
+  std::copy(v.begin(), v.end(), reinterpret_cast<T*>(a->data));
+  a->len = v.size();
+  a->shape[0] = v.size();
+  a->itemsize = sizeof(T);
+  a->strides[0] = sizeof(T);
+  a->format = format;
+  
+  PyObject* const m = PyMemoryView_FromObject(a);
+  Py_DECREF(a);
+  return m;
 }
 
 PyObject*
-forwardSim(PyObject*, PyObject* args, PyObject* kwds)
+genealogy(PyObject*, PyObject* args, PyObject* kwds)
 {
-  static const char *kwlist[] = {"metaCommunity","targetTime", "mu", "lam", "rho", 
-				 "minCAtime", "seed", "cleanEvery",
+  static const char *kwlist[] = {"metaCommunity",
 				 static_cast<const char*>(0)};
   PyObject* metaCom = 0;
-  double targetTime;
-  double minCAtime = -1;
-  double cleanEvery = 1;
-  double mu = 1, lam = 1, rho = 1;
-  double seed = -1;
   
-  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "Odddd|ddd", const_cast<char**>(kwlist),
-				    &metaCom,&targetTime,&mu,&lam,&rho,&minCAtime,&seed,
-				    &cleanEvery)) {
+  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "O", const_cast<char**>(kwlist),
+				    &metaCom)) {
     PyErr_SetString(PyExc_ValueError, "wrong args.") ;
     return 0;
   }
 
-  if( seed >= 0 ) {
-    randomizer.seed(seed);
+  if( ! PyCapsule_IsValid(metaCom, "TMC") ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: not a valid community") ;
+    return 0;
   }
-  
-  //bool trace; // = (pyTrace && PyObject_IsTrue(pyTrace));
-  // bool onTheFlyCom;
-  //MetaCommunity* com = 0;
-  //TracedMetaCommunity* tcom = 0;
 
-  MetaSimulator s(mu, lam, rho);
-  double endTime;
-  PyObject* retVal = 0;
-  
-  if( PyCapsule_IsValid(metaCom, "TMC") ) {
-    TracedMetaCommunity& tcom =
-      *reinterpret_cast<TracedMetaCommunity*>(PyCapsule_GetPointer(metaCom, "TMC"));
-    //trace = true;
-    endTime = s.advance(targetTime, tcom, minCAtime, cleanEvery);
-    retVal = tcom.asPyObject();
-  } else if( PyCapsule_IsValid(metaCom, "MC") ) {
-    MetaCommunity& com =
-      *reinterpret_cast<MetaCommunity*>(PyCapsule_GetPointer(metaCom, "MC"));
-    // trace = false;
-    endTime = s.advance(targetTime, com);
-    retVal = com.asPyObject();
-  } else {
-    PyErr_SetString(PyExc_ValueError, "wrong args: not a valid community") ;
+  TracedMetaCommunity& tcom =
+    *reinterpret_cast<TracedMetaCommunity*>(PyCapsule_GetPointer(metaCom, "TMC"));
+
+  CommunityUse const use(&tcom, true);
+  if( ! use.ok() ) {
     return 0;
   }
 
-  PyObject* o = PyTuple_New(2);
-  PyTuple_SET_ITEM(o, 0, PyFloat_FromDouble(endTime));
-  PyTuple_SET_ITEM(o, 1, retVal);
+  tcom.cleanUp();
+  vector<const PatchTrace*> nodes;
+  vector<int> parent;
+  vector<uint> leaf;
+  tcom.numberNodes(nodes, parent, leaf);
+
+  uint const n = nodes.size();
+  vector<double> times(n);
+  vector<int> plots(n), patches(n);
+  vector<uint> species(n);
+  for(uint x = 0; x < n; ++x) {
+    PatchTrace const& p = *nodes[x];
+    times[x] = p.pTime;
+    bool const f = tcom.isFounder(&p);
+    plots[x] = f ? -1 : p.fromPlot;
+    patches[x] = f ? -1 : p.fromPatch;
+    species[x] = p.speciesIndex;
+  }
+  return Py_BuildValue("NNNNNN", arrayView(parent, "i"), arrayView(times, "d"),
+		       arrayView(plots, "i"), arrayView(patches, "i"),
+		       arrayView(species, "I"), arrayView(leaf, "I"));
+}
+
+// Genealogy of the living individuals as a binary tree. A trace node is the
+// birth of an individual; the lineage of the individual splits off each of
+// its children at the child birth, and ends at the present when still alive.
+static void
+genealogyTree(TracedMetaCommunity const& tcom, vector<double>& height,
+	      vector< std::pair<int,int> >& sons, int& root)
+{
+  vector<const PatchTrace*> nodes;
+  vector<int> parent;
+  vector<uint> leaf;
+  tcom.numberNodes(nodes, parent, leaf);
+  uint const n = nodes.size();
+  unsigned long const nIndividuals = tcom.nIndividuals();
+  double const now = tcom.getTime();
+
+  // tree nodes: individuals first (leaves), then splits
+  height.assign(nIndividuals, now);
+  sons.assign(nIndividuals, std::make_pair(-1, -1));
   
-  return o;
+  vector<int> live(n, -1);
+  for(unsigned long k = 0; k < nIndividuals; ++k) {
+    live[leaf[k]] = k;
+  }
+  // children of each node, latest born first
+  vector< vector<uint> > children(n);
+  for(uint x = 1; x < n; ++x) {
+    children[parent[x]].push_back(x);
+  }
+  
+  // top[x] is the tree node of the lineage of x just below its birth
+  vector<int> top(n, -1);
+  for(uint x = n; x > 0; --x) {
+    vector<uint>& c = children[x-1];
+    std::sort(c.begin(), c.end(), [&](uint a, uint b) {
+	return nodes[a]->pTime > nodes[b]->pTime; });
+    int cur = live[x-1];
+    for(auto y = c.begin(); y != c.end(); ++y) {
+      if( cur < 0 ) {
+	cur = top[*y];
+      } else {
+	height.push_back(nodes[*y]->pTime);
+	sons.push_back(std::make_pair(top[*y], cur));
+	cur = height.size() - 1;
+      }
+    }
+    top[x-1] = cur;
+  }
+  root = top[0];
 }
 
 PyObject*
-CAcounts(PyObject*, PyObject* args, PyObject* kwds)
+genealogyNewick(PyObject*, PyObject* args, PyObject* kwds)
 {
-  static const char *kwlist[] = {"metaCommunity", "nwithin", "nbetween",
+  static const char *kwlist[] = {"metaCommunity",
 				 static_cast<const char*>(0)};
   PyObject* metaCom = 0;
-  int nwithin = 10, nbetween = 10;
   
-  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "O|ii", const_cast<char**>(kwlist),
-				    &metaCom,&nwithin,&nbetween)) {
+  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "O", const_cast<char**>(kwlist),
+				    &metaCom)) {
     PyErr_SetString(PyExc_ValueError, "wrong args.") ;
     return 0;
   }
@@ -785,45 +3676,90 @@ CAcounts(PyObject*, PyObject* args, PyObject* kwds)
   TracedMetaCommunity& tcom =
     *reinterpret_cast<TracedMetaCommunity*>(PyCapsule_GetPointer(metaCom, "TMC"));
 
-  std::uniform_int_distribution<int> pickPlot(0, tcom.nPlots-1);
-  std::uniform_int_distribution<int> pickLocalIndividual(0, tcom.plotSize-1);
-
-  PyObject* tup0 = PyTuple_New(nwithin);
-  
-  for(int k = 0; k < nwithin; ++k) {
-    uint const np = pickPlot(randomizer);
-    uint const j = pickLocalIndividual(randomizer);
-    uint count = 0;
-    for(uint i = 0; i < tcom.plotSize; ++i) {
-      if( i != j ) {
-	const PatchTrace* const p = tcom.ca(np, i, np, j);
-	count += p->pTime > 0;
-      }
-    }
-    PyTuple_SET_ITEM(tup0, k, PyInt_FromLong(count));
+  CommunityUse const use(&tcom, true);
+  if( ! use.ok() ) {
+    return 0;
   }
 
-  PyObject* tup1 = PyTuple_New(nbetween);
-  for(int k = 0; k < nbetween; ++k) {
-    uint const np0 = pickPlot(randomizer);
-    uint np1 = np0;
-    while( np1 == np0 ) {
-      np1 = pickPlot(randomizer);
+  tcom.cleanUp();
+  vector<double> height;
+  vector< std::pair<int,int> > sons;
+  int root;
+  genealogyTree(tcom, height, sons, root);
+
+  // Without recursion, genealogies may be very deep. A stack entry is a
+  // node and the number of its sons done.
+  std::string t;
+  char b[64];
+  vector< std::pair<int,int> > stack(1, std::make_pair(root, 0));
+  while( ! stack.empty() ) {
+    int const x = stack.back().first;
+    int& state = stack.back().second;
+    if( sons[x].first < 0 ) {
+      // leaf: plot_individual
+      snprintf(b, sizeof(b), "%u_%u", uint(x / tcom.plotSize), uint(x % tcom.plotSize));
+      t += b;
+      state = 2;
+    } else if( state == 0 ) {
+      t += '(';
+      state = 1;
+      stack.push_back(std::make_pair(sons[x].first, 0));
+      continue;
+    } else if( state == 1 ) {
+      t += ',';
+      state = 2;
+      stack.push_back(std::make_pair(sons[x].second, 0));
+      continue;
+    } else {
+      t += ')';
     }
-    uint const j = pickLocalIndividual(randomizer);
-    uint count = 0;
-    for(uint i = 0; i < tcom.plotSize; ++i) {
-      const PatchTrace* const p = tcom.ca(np0, j, np1, i);
-      count += p->pTime > 0;
+    stack.pop_back();
+    if( ! stack.empty() ) {
+      snprintf(b, sizeof(b), ":%.17g", height[x] - height[stack.back().first]);
+      t += b;
     }
-    PyTuple_SET_ITEM(tup1, k, PyInt_FromLong(count));
   }
+  t += ';';
+  return PyString_FromStringAndSize(t.data(), t.size());
+}
+
+PyObject*
+speciesView(PyObject*, PyObject* args, PyObject* kwds)
+{
+  static const char *kwlist[] = {"metaCommunity",
+				 static_cast<const char*>(0)};
+  PyObject* metaCom = 0;
   
-  return Py_BuildValue("NN", tup0, tup1);
+  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "O", const_cast<char**>(kwlist),
+				    &metaCom)) {
+    PyErr_SetString(PyExc_ValueError, "wrong args.") ;
+    return 0;
+  }
+
+  MetaCommunity* const com = getCommunity(metaCom);
+  if( ! com ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: not a valid community") ;
+    return 0;
+  }
+  CommunityUse const use(com, false);
+  if( ! use.ok() ) {
+    return 0;
+  }
+
+  SpeciesBufferObject* const b = PyObject_New(SpeciesBufferObject, &SpeciesBufferType);
+  if( ! b ) {
+    return 0;
+  }
+  Py_INCREF(metaCom);
+  b->owner = metaCom;
+  
+  PyObject* const v = PyMemoryView_FromObject(b);
+  Py_DECREF(b);
+  return v;
 }
 
 PyObject*
-optTraces(PyObject*, PyObject* args, PyObject* kwds)
+getRandomState(PyObject*, PyObject* args, PyObject* kwds)
 {
   static const char *kwlist[] = {"metaCommunity",
 				 static_cast<const char*>(0)};
@@ -835,38 +3771,306 @@ optTraces(PyObject*, PyObject* args, PyObject* kwds)
     return 0;
   }
 
-  if( ! PyCapsule_IsValid(metaCom, "TMC") ) {
+  MetaCommunity* const com = getCommunity(metaCom);
+  if( ! com ) {
     PyErr_SetString(PyExc_ValueError, "wrong args: not a valid community") ;
     return 0;
   }
 
-  TracedMetaCommunity& tcom =
-    *reinterpret_cast<TracedMetaCommunity*>(PyCapsule_GetPointer(metaCom, "TMC"));
+  CommunityUse const use(com, false);
+  if( ! use.ok() ) {
+    return 0;
+  }
+  return randomStateAsPyObject(com->rng);
+}
+
+PyObject*
+setRandomState(PyObject*, PyObject* args, PyObject* kwds)
+{
+  static const char *kwlist[] = {"metaCommunity", "randomState",
+				 static_cast<const char*>(0)};
+  PyObject* metaCom = 0;
+  PyObject* randomState = 0;
+  
+  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "OO", const_cast<char**>(kwlist),
+				    &metaCom, &randomState)) {
+    PyErr_SetString(PyExc_ValueError, "wrong args.") ;
+    return 0;
+  }
+
+  MetaCommunity* const com = getCommunity(metaCom);
+  if( ! com ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: not a valid community") ;
+    return 0;
+  }
+
+  CommunityUse const use(com, true);
+  if( ! use.ok() ) {
+    return 0;
+  }
+  if( ! randomStateFromPyObject(randomState, com->rng) ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: invalid random state");
+    return 0;
+  }
+  
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+PyObject*
+speciesInfo(PyObject*, PyObject* args, PyObject* kwds)
+{
+  static const char *kwlist[] = {"metaCommunity",
+				 static_cast<const char*>(0)};
+  PyObject* metaCom = 0;
+  
+  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "O", const_cast<char**>(kwlist),
+				    &metaCom)) {
+    PyErr_SetString(PyExc_ValueError, "wrong args.") ;
+    return 0;
+  }
+
+  MetaCommunity* const com = getCommunity(metaCom);
+  if( ! com ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: not a valid community") ;
+    return 0;
+  }
+
+  CommunityUse const use(com, false);
+  if( ! use.ok() ) {
+    return 0;
+  }
+  return Py_BuildValue("III", com->nLiveSpecies(), com->maxLiveSpecies(),
+		       com->getLastSpecies());
+}
+
+PyObject*
+runStats(PyObject*, PyObject* args, PyObject* kwds)
+{
+  static const char *kwlist[] = {"metaCommunity",
+				 static_cast<const char*>(0)};
+  PyObject* metaCom = 0;
+  
+  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "O", const_cast<char**>(kwlist),
+				    &metaCom)) {
+    PyErr_SetString(PyExc_ValueError, "wrong args.") ;
+    return 0;
+  }
+
+  MetaCommunity* const com = getCommunity(metaCom);
+  if( ! com ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: not a valid community") ;
+    return 0;
+  }
+
+  CommunityUse const use(com, false);
+  if( ! use.ok() ) {
+    return 0;
+  }
+  if( PyCapsule_IsValid(metaCom, "TMC") ) {
+    TracedMetaCommunity const& tcom = *static_cast<TracedMetaCommunity*>(com);
+    return Py_BuildValue("KnndK", com->eventsCount(),
+			 static_cast<Py_ssize_t>(tcom.traceNodes()),
+			 static_cast<Py_ssize_t>(tcom.peakTraceNodes()),
+			 tcom.cleanUpTime(),
+			 static_cast<unsigned long long>(tcom.cleanUpsCount()));
+  }
+  return Py_BuildValue("KiidK", com->eventsCount(), 0, 0, 0.0, 0ULL);
+}
+
+// Checkpoint file: magic, format version, flags (traced, recycled species)
+// and community sizes, followed by the community itself.
+static char const checkpointMagic[4] = {'N','S','M','C'};
+static uint32_t const checkpointVersion = 1;
+
+PyObject*
+saveCommunity(PyObject*, PyObject* args, PyObject* kwds)
+{
+  static const char *kwlist[] = {"metaCommunity", "fileName",
+				 static_cast<const char*>(0)};
+  PyObject* metaCom = 0;
+  const char* fileName = 0;
+  
+  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "Os", const_cast<char**>(kwlist),
+				    &metaCom, &fileName)) {
+    PyErr_SetString(PyExc_ValueError, "wrong args.") ;
+    return 0;
+  }
+
+  MetaCommunity* const com = getCommunity(metaCom);
+  if( ! com ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args: not a valid community") ;
+    return 0;
+  }
+
+  CommunityUse const use(com, false);
+  if( ! use.ok() ) {
+    return 0;
+  }
+  TracedMetaCommunity* const tcom = PyCapsule_IsValid(metaCom, "TMC") ?
+    static_cast<TracedMetaCommunity*>(com) : 0;
 
-  tcom.optTraces();
+  FILE* const f = fopen(fileName, "wb");
+  if( ! f ) {
+    return PyErr_SetFromErrnoWithFilename(PyExc_IOError, const_cast<char*>(fileName));
+  }
+
+  bool ok;
+  Py_BEGIN_ALLOW_THREADS
+  ok = fwrite(checkpointMagic, sizeof(checkpointMagic), 1, f) == 1 &&
+    put(f, checkpointVersion) &&
+    put(f, static_cast<uint32_t>((tcom ? 1 : 0) | (com->recyclesSpecies() ? 2 : 0))) &&
+    put(f, static_cast<uint32_t>(com->nPlots)) && put(f, static_cast<uint32_t>(com->plotSize)) &&
+    (tcom ? tcom->write(f) : com->write(f));
+  ok = (fclose(f) == 0) && ok;
+  Py_END_ALLOW_THREADS
+
+  if( ! ok ) {
+    return PyErr_SetFromErrnoWithFilename(PyExc_IOError, const_cast<char*>(fileName));
+  }
   
   Py_INCREF(Py_None);
   return Py_None;
 }
 
+PyObject*
+loadCommunity(PyObject*, PyObject* args, PyObject* kwds)
+{
+  static const char *kwlist[] = {"fileName",
+				 static_cast<const char*>(0)};
+  const char* fileName = 0;
+  
+  if( ! PyArg_ParseTupleAndKeywords(args, kwds, "s", const_cast<char**>(kwlist),
+				    &fileName)) {
+    PyErr_SetString(PyExc_ValueError, "wrong args.") ;
+    return 0;
+  }
+
+  FILE* const f = fopen(fileName, "rb");
+  if( ! f ) {
+    return PyErr_SetFromErrnoWithFilename(PyExc_IOError, const_cast<char*>(fileName));
+  }
+
+  char magic[4];
+  uint32_t version, flags, nPlots, plotSize;
+  MetaCommunity* com = 0;
+  TracedMetaCommunity* tcom = 0;
+  bool ok = false;
+  
+  Py_BEGIN_ALLOW_THREADS
+  if( fread(magic, sizeof(magic), 1, f) == 1 &&
+      std::equal(magic, magic+4, checkpointMagic) &&
+      get(f, version) && version == checkpointVersion &&
+      get(f, flags) && get(f, nPlots) && get(f, plotSize) &&
+      nPlots > 0 && plotSize > 0 ) {
+    try {
+      if( flags & 1 ) {
+	tcom = new TracedMetaCommunity(nPlots, plotSize);
+	tcom->setRecycleSpecies(flags & 2);
+	ok = tcom->read(f);
+      } else {
+	com = new MetaCommunity(nPlots, plotSize);
+	com->setRecycleSpecies(flags & 2);
+	ok = com->read(f);
+      }
+    } catch (std::bad_alloc&) {
+      ok = false;
+    }
+  }
+  fclose(f);
+  Py_END_ALLOW_THREADS
+  
+  if( ! ok ) {
+    delete tcom;
+    delete com;
+    PyErr_SetString(PyExc_ValueError, "not a valid community checkpoint.");
+    return 0;
+  }
+  
+  void* c = tcom ? static_cast<void*>(tcom) : static_cast<void*>(com);
+  return PyCapsule_New(c, tcom ? "TMC" : "MC", metaDestructor);
+}
+
 static PyMethodDef neutralsimMethods[] = {
   {"forwardSimulation",	(PyCFunction)forwardSim, METH_VARARGS|METH_KEYWORDS,
-   ""},
+   "Advance community to target time. Returns (endTime, community), or with"
+   " stats/snapshots the abundance summaries/species of all individuals at each"
+   " of sampleTimes and at target time (snapshots as one string of uint32). A"
+   " run stopped by minCAtime ends with the state at its end time instead."
+   " batchRandom=False draws events one by one from the community stream."
+   " nThreads splits plots between threads, synchronizing every epoch (default"
+   " 0.01/mu), where immigrants from plots of other threads are up to one epoch"
+   " stale; threads run without the interpreter lock, and other calls on the"
+   " community raise ValueError meanwhile. Immigrants come from plots weighted by a dispersal matrix (row per"
+   " destination plot) or by the kernel exp(-d/kernelScale) of plot positions,"
+   " truncated at kernelCutoff (default 5 x kernelScale), if given. leap=tau"
+   " runs an approximate tau leaping simulation of untraced plot abundances in"
+   " steps of tau, and appends (steps, events, highest fraction of a plot replaced"
+   " in one step, clipped deaths) to the result."},
+  {"forwardSimBatch",	(PyCFunction)forwardSimBatch, METH_VARARGS|METH_KEYWORDS,
+   "Run independent replicates of a forward simulation from a fresh community"
+   " in parallel. Returns a (endTime, community) tuple per replicate."},
+  {"backwardSimulation", (PyCFunction)backwardSim, METH_VARARGS|METH_KEYWORDS,
+   "Genealogy of a sample from a community at equilibrium, simulated backward in"
+   " time. Returns (parents, ages, plots, species), one entry per node, where"
+   " sampled individuals come first (plot by plot) and the root last."},
   {"newCommunity",  	(PyCFunction)newCommunity, METH_VARARGS|METH_KEYWORDS,
-   ""},
+   "With recycleSpecies=True new species take the smallest number of an extinct"
+   " one, keeping species numbers dense. Recycling is off by default (so species"
+   " in traces stay unambiguous), and then the community keeps a count for every"
+   " species number ever assigned: memory grows with the number of speciations"
+   " over the whole run, not with the number of live species."},
   {"CAcounts",		(PyCFunction)CAcounts, METH_VARARGS|METH_KEYWORDS,
-   ""},
+   "With index=True common ancestors are found through an index of a snapshot of"
+   " the traces, O(1) per pair."},
+  {"coalescenceTimes",	(PyCFunction)coalescenceTimes, METH_VARARGS|METH_KEYWORDS,
+   "Matrix of the times of the common ancestor of each pair of a sample of"
+   " (plot, individual) from a traced community."},
   {"optTraces",		(PyCFunction)optTraces, METH_VARARGS|METH_KEYWORDS,
-   ""},
+   "Drop trace nodes inside chains with a single descendant branch, with plots"
+   " split between nThreads threads (default all cores) and without holding the"
+   " interpreter lock. Other calls on the community raise ValueError meanwhile."},
+  {"speciesView",	(PyCFunction)speciesView, METH_VARARGS|METH_KEYWORDS,
+   "Species of community individuals as a read only (nPlots x plotSize) buffer"
+   " of uint32, shared with the community (e.g. numpy.asarray(speciesView(c)))."},
+  {"getRandomState",	(PyCFunction)getRandomState, METH_VARARGS|METH_KEYWORDS,
+   "State of community random stream (a tuple of 4 integers)."},
+  {"setRandomState",	(PyCFunction)setRandomState, METH_VARARGS|METH_KEYWORDS,
+   "Restore community random stream from state given by getRandomState."},
+  {"genealogy",		(PyCFunction)genealogy, METH_VARARGS|METH_KEYWORDS,
+   "Trace nodes of a traced community as flat arrays (parents, times, plots,"
+   " patches, species, leaves), parents first. leaves is the node of each"
+   " individual. Arrays are memoryviews, numpy.asarray does not copy them."},
+  {"genealogyNewick",	(PyCFunction)genealogyNewick, METH_VARARGS|METH_KEYWORDS,
+   "Genealogy of the individuals of a traced community in Newick format. Taxa are"
+   " plot_individual and branch lengths are in simulation time."},
+  {"speciesInfo",	(PyCFunction)speciesInfo, METH_VARARGS|METH_KEYWORDS,
+   "(number of live species, highest live species number, highest species number"
+   " assigned) of a community."},
+  {"runStats",		(PyCFunction)runStats, METH_VARARGS|METH_KEYWORDS,
+   "(events, trace nodes, peak trace nodes, seconds in trace clean up, number of"
+   " clean ups) of a community since it was created. Zero trace figures for"
+   " untraced communities."},
+  {"saveCommunity",	(PyCFunction)saveCommunity, METH_VARARGS|METH_KEYWORDS,
+   "Save community (with traces and random state) to a binary checkpoint file."
+   " Written without holding the interpreter lock, and calls changing the"
+   " community raise ValueError meanwhile."},
+  {"loadCommunity",	(PyCFunction)loadCommunity, METH_VARARGS|METH_KEYWORDS,
+   "Load community from a checkpoint written by saveCommunity. Simulation of"
+   " the loaded community continues exactly as the saved one would."},
   {NULL, NULL, 0, NULL}        /* Sentinel */
 };
 
 PyMODINIT_FUNC
 initneutralsim(void)
 {
-  randomizer.seed( time(0) );
+  seeder.seed( time(0) );
   
   //import_array();
   
+  if( PyType_Ready(&SpeciesBufferType) < 0 || PyType_Ready(&ArrayType) < 0 ) {
+    return;
+  }
+  
   /*PyObject* m = */ Py_InitModule("neutralsim", neutralsimMethods);
 }
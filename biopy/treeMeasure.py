@@ -350,6 +350,12 @@ def setTreeClades(tree):
   return r
 
 def cladesInTreesSet(trees, withPairs=False, tidyup=True, func=None, withTaxa = False) :
+  if func is None and not withPairs and hasattr(trees, "cladeCounts") :
+    # a treesset.TreesSet, counted natively
+    taxa, clades, counts = trees.cladeCounts(withTaxa = withTaxa)
+    return dict([(frozenset([taxa[i] for i in c]), n)
+                 for c,n in zip(clades, counts)])
+  
   newitem = (lambda : 0) if func is None else (lambda : [])
   clc = defaultdict(newitem)
   clc2 = defaultdict(newitem) if withPairs else None
@@ -1,10 +1,19 @@
 #include <Python.h>
 #include "structmember.h"
+#include "marshal.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
 
 #include <cassert>
 
 #include <cmath>
 #include <limits>
+#include <cstdio>
+#include <cstring>
 
 #include <string>
 using std::string;
@@ -15,6 +24,10 @@ using std::vector;
 using std::stack;
 #include <list>
 using std::list;
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <system_error>
 
 // for compilers lacking it
 typedef unsigned int uint;
@@ -123,40 +136,53 @@ skipSpaces(const char* txt)
   return s - txt;
 }
 
-#undef PYINTERFACE
+// Trees are tokenized in place: taxa, labels and attribute names and values
+// are spans of the tree text, and are copied into strings only when a tree is
+// stored.
+
+// A piece of text, not NUL terminated.
+struct TextSpan {
+  TextSpan() :
+    s(0),
+    n(0)
+    {}
+  
+  TextSpan(const char* s_, uint n_) :
+    s(s_),
+    n(n_)
+    {}
+
+  explicit TextSpan(string const& x) :
+    s(x.c_str()),
+    n(x.size())
+    {}
+
+  uint		size(void) const { return n; }
+  string	str(void) const { return string(s, n); }
+  
+  const char* 	s;
+  uint 		n;
+};
 
-#ifdef PYINTERFACE
-// trim spaces from both ends of string, return python string
-static inline PyObject*
-trimString(string const& s)
+// span without leading and trailing spaces
+static inline TextSpan
+trimmed(const char* s, int n)
 {
-  const char* txt = s.c_str();
-  int const n0 = skipSpaces(txt);
-  int n1 = s.length()-1;
-  while( n1 >= 0 && isspace(txt[n1]) ) {
-    --n1;
+  while( n > 0 && isspace(*s) ) {
+    ++s; --n;
   }
-  return PyString_FromStringAndSize(txt + n0, n1+1-n0);
-}
-#else
-static inline string
-trimString(string const& s)
-{
-  const char* txt = s.c_str();
-  int const n0 = skipSpaces(txt);
-  int n1 = s.length()-1;
-  while( n1 >= 0 && isspace(txt[n1]) ) {
-    --n1;
+  while( n > 0 && isspace(s[n-1]) ) {
+    --n;
   }
-  return string(txt + n0, n1+1-n0);
+  return TextSpan(s, n);
 }
-#endif
 
-
-#ifndef PYINTERFACE
 // list
 typedef vector< std::pair<string,string> > Attributes;
 
+// (name, value) pairs, of all nodes of one parsed tree
+typedef vector< std::pair<TextSpan,TextSpan> > AttributeSpans;
+
 static PyObject*
 attributesAsPyObj(const Attributes* const attributes)
 {
@@ -179,49 +205,86 @@ class ParsedTreeNode {
 public:
   ParsedTreeNode() :
     branch(0),
-    attributes(0)
+    hasBranch(false),
+    hasAttributes(false),
+    atrsBegin(0),
+    atrsEnd(0)
     {}
 
-  ~ParsedTreeNode() {
-    delete branch;
-    delete attributes;
-  }
+  PyObject* asPyObject(AttributeSpans const& atrs) const;
 
-  ParsedTreeNode(ParsedTreeNode const& o) :
-    taxon(o.taxon),
-    sons(o.sons)
-    {
-      // steal memebers from initializer. make sure he can't
-      // access them anymore.
-      branch = o.branch;
-      attributes = o.attributes;
-      const_cast<ParsedTreeNode&>(o).branch = 0;
-      const_cast<ParsedTreeNode&>(o).attributes = 0;
-    }
+  // tip taxon or internal node label
+  TextSpan		taxon;
+  double 		branch;
+  bool			hasBranch;
+  std::vector<uint> 	sons;
+  // node attributes are [atrsBegin,atrsEnd) of the tree attributes
+  bool			hasAttributes;
+  uint			atrsBegin;
+  uint			atrsEnd;
+};
 
-  PyObject* asPyObject(void) const;
+// A tree parsed from text, nodes in post order (root last). Spans point into
+// the text, so the tree is valid only as long as the text is, unless
+// interned.
+class ParsedTree {
+public:
+  ParsedTree() {}
+  ParsedTree(ParsedTree&&) = default;
+  ParsedTree& operator=(ParsedTree&&) = default;
+  // copies would share interned text
+  ParsedTree(ParsedTree const&) = delete;
+  
+  // copy all spans into 'text', for keeping the tree after the text it was
+  // parsed from is gone.
+  void intern(void);
 
-  string 		taxon;
-  double* 		branch;
-  std::vector<uint> 	sons;
-  Attributes* 		attributes;
+  vector<ParsedTreeNode> 	nodes;
+  AttributeSpans		attributes;
+  vector<char>			text;
 };
 
+void
+ParsedTree::intern(void)
+{
+  size_t len = 0;
+  for(auto n = nodes.begin(); n != nodes.end(); ++n) {
+    len += n->taxon.size();
+  }
+  for(auto a = attributes.begin(); a != attributes.end(); ++a) {
+    len += a->first.size() + a->second.size();
+  }
+  text.resize(len);
+  char* p = text.data();
+  auto copy = [&p](TextSpan& x) {
+    memcpy(p, x.s, x.n);
+    x.s = p;
+    p += x.n;
+  };
+  for(auto n = nodes.begin(); n != nodes.end(); ++n) {
+    copy(n->taxon);
+  }
+  for(auto a = attributes.begin(); a != attributes.end(); ++a) {
+    copy(a->first);
+    copy(a->second);
+  }
+}
+
 PyObject*
-ParsedTreeNode::asPyObject(void) const
+ParsedTreeNode::asPyObject(AttributeSpans const& atrs) const
 {
   PyObject* const nodeData = PyList_New(4);
 
   if( taxon.size() > 0 ) {
-    PyList_SET_ITEM(nodeData, 0, PyString_FromStringAndSize(taxon.c_str(),taxon.size()));
+    PyList_SET_ITEM(nodeData, 0, PyString_FromStringAndSize(taxon.s, taxon.size()));
   } else {
     Py_INCREF(Py_None);
     PyList_SET_ITEM(nodeData, 0, Py_None);
   }
     
   PyObject* b;
-  if( branch ) {
-    b = PyFloat_FromDouble(*branch);
+  if( hasBranch ) {
+    b = PyFloat_FromDouble(branch);
   } else {
     Py_INCREF(Py_None);
     b = Py_None;
@@ -239,30 +302,27 @@ ParsedTreeNode::asPyObject(void) const
     Py_INCREF(Py_None);
     PyList_SET_ITEM(nodeData, 2, Py_None);
   }
-  
-  PyList_SET_ITEM(nodeData, 3, attributesAsPyObj(attributes));
+
+  if( hasAttributes ) {
+    PyObject* a = PyDict_New();
+    for(uint k = atrsBegin; k < atrsEnd; ++k) {
+      PyObject* const val = PyString_FromStringAndSize(atrs[k].second.s, atrs[k].second.size());
+      PyObject* const key = PyString_FromStringAndSize(atrs[k].first.s, atrs[k].first.size());
+      PyDict_SetItem(a, key, val);
+      Py_DECREF(key);
+      Py_DECREF(val);
+    }
+    PyList_SET_ITEM(nodeData, 3, a);
+  } else {
+    Py_INCREF(Py_None);
+    PyList_SET_ITEM(nodeData, 3, Py_None);
+  }
 
   return nodeData;
 }
 
-#endif
-
-typedef
-#if PYINTERFACE
-PyObject*
-#else
-ParsedTreeNode
-#endif
-returnType;
-
 static int
-parseAttributes(const char* s,
-#if PYINTERFACE
-vector<PyObject*>&
-#else
-Attributes&
-#endif
-		vals)
+parseAttributes(const char* s, AttributeSpans& vals)
 {
   int eat = 0;
   while( *s != ']' ) {
@@ -275,17 +335,17 @@ Attributes&
     if( s[nameEnd] != '=' ) {
       return -eat-1;
     }
-    string name(s, nameEnd);
+    TextSpan const name = trimmed(s, nameEnd);
     s += nameEnd+1;
     eat += nameEnd+1;
 
-    string v;
+    TextSpan v;
     if( *s == '"' ) {
       int const e = _getStuff(s+1, '"');
       if( e < 0 ) {
 	return -eat-1;
       } else {
-        v = string(s+1, e);
+        v = trimmed(s+1, e);
         s += e+2;
         eat += e+2;
       }
@@ -294,7 +354,7 @@ Attributes&
       if( e < 0 ) {
 	return -eat-1;
       } else {
-	v = string(s+1, e);
+	v = trimmed(s+1, e);
 	s += e+2;
 	eat += e+2;
       }
@@ -303,53 +363,36 @@ Attributes&
       if( e == -1 ) {
 	return -eat-1;
       }
-      v = string(s, e);
+      v = trimmed(s, e);
       s += e;
       eat += e;
     }
 
-#if PYINTERFACE
-    PyObject* o = PyTuple_New(2);
-    PyTuple_SET_ITEM(o, 0, trimString(name));
-    PyTuple_SET_ITEM(o, 1, trimString(v));
-    vals.push_back(o);
-#else
-    std::pair<string,string> a(trimString(name),trimString(v));
-    vals.push_back(a);
-#endif
+    vals.push_back(std::pair<TextSpan,TextSpan>(name, v));
   }
   return eat;
 }
 
 
 static int
-readSubTree(const char* txt, vector<returnType>& nodes)
+readSubTree(const char* txt, ParsedTree& tree)
 {
   int eat = skipSpaces(txt);
   txt += eat;
   
-#if PYINTERFACE
-  PyObject* vals = NULL;
-  PyObject* const nodeData = PyList_New(4);
-#else
   ParsedTreeNode nodeData;
-#endif
   
   if( *txt == '(' ) {
-#if PYINTERFACE
-    vector<int> subs;
-#else
     vector<uint>& subs = nodeData.sons;
-#endif
     
     while( true ) {
-      int n1 = readSubTree(txt+1, nodes);
+      int n1 = readSubTree(txt+1, tree);
       if( n1 <= 0 ) {
 	return std::min(n1 - eat,-1);
       }
       eat += 1+n1;
       txt += 1+n1;
-      subs.push_back(nodes.size()-1);
+      subs.push_back(tree.nodes.size()-1);
 
       n1 = skipSpaces(txt);
       eat += n1;
@@ -358,18 +401,6 @@ readSubTree(const char* txt, vector<returnType>& nodes)
         continue;
       }
       if( *txt == ')' ) {
-#ifdef PYINTERFACE	
-	int const ns = subs.size();
-	PyObject* psubs = PyList_New(ns);
-	for(int k = 0; k < ns; ++k) { 
-	  PyList_SET_ITEM(psubs, k, PyLong_FromLong(subs[k]));
-	}
-	PyList_SET_ITEM(nodeData, 2, psubs);
-
-	Py_INCREF(Py_None);
-	PyList_SET_ITEM(nodeData, 0, Py_None);
-#endif
-	
 	eat += 1;
         txt += 1;
         break;
@@ -393,62 +424,36 @@ readSubTree(const char* txt, vector<returnType>& nodes)
       }
     }
     int const n1 = s - txt;
-#ifdef PYINTERFACE
-    PyList_SET_ITEM(nodeData, 0, PyString_FromStringAndSize(txt, n1));
-
-    Py_INCREF(Py_None);
-    PyList_SET_ITEM(nodeData, 2, Py_None);
-#else
-    nodeData.taxon = string(txt, n1);
-#endif
+    nodeData.taxon = TextSpan(txt, n1);
     
     eat += n1;
     txt += n1;
   }
 
-  {
-    int const n1 = skipSpaces(txt);
-    txt += n1;
-    eat += n1;
-  }
-
-  string nodeTxt;
+  // Label, ':' and branch length, in any order with comments and attributes.
+  // Anything else after the branch is ignored.
+  const char* label = 0;
+  const char* labelEnd = 0;
+  bool colon = false;
+  
   while( *txt ) {
     if( has(*txt, "(),;") ) {
       break;
     }
     if( *txt == '[' ) {
       if( txt[1] == '&' ) {
-#ifdef PYINTERFACE
-	vector<PyObject*> vs;
-#else
-	nodeData.attributes = new Attributes;
-	Attributes& vs = *nodeData.attributes;
-#endif	
+	AttributeSpans& vs = tree.attributes;
+	uint const b = vs.size();
 	int n1 = parseAttributes(txt+2, vs);
 	if( n1 < 0 ) {
 	  return n1 - (eat+2);
 	}
+	nodeData.hasAttributes = true;
+	nodeData.atrsBegin = b;
+	nodeData.atrsEnd = vs.size();
 	n1 += 3;
-	n1 += skipSpaces(txt+n1);
 	eat += n1;
 	txt += n1;
-
-#ifdef PYINTERFACE
-	if( vs.size() > 0 ) {
-	  int b;
-	  if( vals == NULL ) {
-	    vals = PyTuple_New(vs.size());
-	    b = 0;
-	  } else {
-	    b = PyTuple_Size(vals);
-	    _PyTuple_Resize(&vals, b + vs.size());
-	  }
-	  for(unsigned int k = 0; k < vs.size(); ++k) {
-	    PyTuple_SET_ITEM(vals, b+k, vs[k]);
-	  }
-	}
-#endif
       } else {
 	// skip comment
 	int const e = _getStuff(txt+1, ']');
@@ -459,69 +464,270 @@ readSubTree(const char* txt, vector<returnType>& nodes)
 	  eat += e+2;
 	}
       }
+    } else if( isspace(*txt) ) {
+      txt += 1;
+      eat += 1;
+    } else if( colon && ! nodeData.hasBranch ) {
+      char* endp;
+      double const b = strtod(txt, &endp);
+      int const n1 = endp - txt;
+      if( n1 == 0 ) {
+	return -eat-1;
+      }
+      nodeData.branch = b;
+      nodeData.hasBranch = true;
+      txt += n1;
+      eat += n1;
     } else {
-      //if( isspace(*txt) || isdigit(*txt) || has(*txt, ":.+-Ee") ) {
-      nodeTxt.append(txt, 1);
+      if( *txt == ':' ) {
+	colon = true;
+      } else if( ! colon ) {
+	if( ! label ) {
+	  label = txt;
+	}
+	labelEnd = txt+1;
+      }
       txt += 1;
       eat += 1;
-      // } else {
-      // 	break;
-      // }
     }
   }
-
-#if PYINTERFACE
-  if( ! vals ) {
-    Py_INCREF(Py_None);
-    vals = Py_None;
+  if( colon && ! nodeData.hasBranch ) {
+    return -eat-1;
+  }
+  if( label ) {
+    nodeData.taxon = TextSpan(label, labelEnd - label);
   }
-  PyList_SET_ITEM(nodeData, 3, vals);
 
-  PyObject* branch = NULL;
-#endif
+  tree.nodes.push_back(std::move(nodeData));
 
-  //std::cout << nodeTxt << std::endl;  
-  const char* nTxt = nodeTxt.c_str();
-  nTxt += skipSpaces(nTxt);
-  if( *nTxt ) {
-    int const i = findIndex(nTxt, ':',"");
-    if( i != 0 ) {
-      int const k = (i>0) ? i : strlen(nTxt);
-#if PYINTERFACE
-      PyList_SET_ITEM(nodeData, 0, trimString(string(nTxt,k)));
-#else
-      nodeData.taxon = string(nTxt,k);
-#endif
-      nTxt += k;
+  return eat;
+}
+
+// Reading tree files, a NEXUS trees block or plain NEWICK trees.
+
+// End of the statement starting at s, the position of its ';' or 'end'.
+// A ';' inside a comment or quotes does not end a statement.
+static const char*
+statementEnd(const char* s, const char* const end)
+{
+  while( s < end && *s != ';' ) {
+    if( *s == '[' ) {
+      const char* const e = static_cast<const char*>(memchr(s, ']', end - s));
+      s = e ? e + 1 : end;
+    } else if( *s == '\'' || *s == '"' ) {
+      // a doubled quote closes and reopens
+      const char* const e = static_cast<const char*>(memchr(s + 1, *s, end - (s + 1)));
+      s = e ? e + 1 : end;
+    } else {
+      ++s;
     }
-    if( i >= 0 ) {
-      int n1 = skipSpaces(nTxt+1);
-      nTxt += 1+n1;
-    
-      //std::cout << nTxt << std::endl;  
-      char* endp;
-      double const b = strtod(nTxt, &endp);
-      n1 = endp - nTxt;
-      if( n1 == 0 ) {
-	return -eat-1;
+  }
+  return s;
+}
+
+// Skip spaces and comments
+static const char*
+skipFiller(const char* s, const char* const end)
+{
+  while( s < end ) {
+    if( isspace(*s) ) {
+      ++s;
+    } else if( *s == '[' && (s+1 == end || s[1] != '&') ) {
+      const char* const e = static_cast<const char*>(memchr(s, ']', end - s));
+      s = e ? e + 1 : end;
+    } else {
+      break;
+    }
+  }
+  return s;
+}
+
+// True if text at s is the word w (in any case). Moves s past it.
+static bool
+isWord(const char*& s, const char* const end, const char* w)
+{
+  uint const n = strlen(w);
+  if( static_cast<uint>(end - s) < n || strncasecmp(s, w, n) != 0 ||
+      (s + n < end && (isalnum(s[n]) || s[n] == '_')) ) {
+    return false;
+  }
+  s += n;
+  return true;
+}
+
+// NEXUS word at s (quoted or up to a space or one of 'stop'). Moves s past
+// it and removes the quotes.
+static string
+nexusWord(const char*& s, const char* const end, const char* stop)
+{
+  s = skipFiller(s, end);
+  string w;
+  if( s < end && (*s == '\'' || *s == '"') ) {
+    char const q = *s;
+    for(++s; s < end; ++s) {
+      if( *s == q ) {
+	if( s+1 < end && s[1] == q ) {
+	  w.push_back(q);
+	  ++s;
+	} else {
+	  ++s;
+	  break;
+	}
+      } else {
+	w.push_back(*s);
       }
-#if PYINTERFACE    
-      branch = PyFloat_FromDouble(b);
-#else
-      nodeData.branch = new double(b);
-#endif
+    }
+  } else {
+    while( s < end && ! isspace(*s) && ! has(*s, stop) ) {
+      w.push_back(*s);
+      ++s;
     }
   }
-#if PYINTERFACE
-  if( branch == NULL ) {
-    Py_INCREF(Py_None);
-    branch = Py_None;
+  return w;
+}
+
+// Taxon name as INexus gives it: quoted when it has spaces or punctuation.
+static string
+nexusTaxon(string const& name)
+{
+  string safe;
+  bool quote = false;
+  for(auto c = name.begin(); c != name.end(); ++c) {
+    if( *c == '\'' ) {
+      safe.push_back('\'');
+    }
+    safe.push_back(*c);
+    quote = quote || isspace(*c) || has(*c, "()[]{}/\\,;:=*'\"`+-<>");
   }
-  PyList_SET_ITEM(nodeData, 1, branch);
-#endif
-  nodes.push_back(nodeData);
+  return quote ? "'" + safe + "'" : safe;
+}
 
-  return eat;
+typedef unordered_map<string,string> TranslateTable;
+
+// Parse body of a translate statement
+static bool
+readTranslate(const char* s, const char* const end, TranslateTable& table)
+{
+  while( true ) {
+    string const key = nexusWord(s, end, ",");
+    string const label = nexusWord(s, end, ",");
+    if( key.empty() || label.empty() ) {
+      return false;
+    }
+    table[key] = nexusTaxon(label);
+    s = skipFiller(s, end);
+    if( s == end ) {
+      return true;
+    }
+    if( *s != ',' ) {
+      return false;
+    }
+    ++s;
+  }
+}
+
+// A tree statement of a file
+struct TreeStatement {
+  // NEWICK text, up to the statement end
+  const char* begin;
+  const char* end;
+  // 0 for plain NEWICK
+  const char* name;
+  uint	      nameLen;
+  // -1 unknown, otherwise 0/1 from a [&U]/[&R] comment
+  int	      rooted;
+  // table in effect, 0 if none
+  TranslateTable const* translate;
+};
+
+// Tree statements of a whole file. With 'nexus' false every statement is a
+// NEWICK tree. Returns false on a malformed NEXUS statement, with 'bad' at
+// its start.
+static bool
+treeStatements(const char* const text, const char* const end, bool const nexus,
+	       list<TranslateTable>& tables, vector<TreeStatement>& trees,
+	       const char*& bad)
+{
+  bool inTrees = ! nexus;
+  TranslateTable const* translate = 0;
+  
+  for(const char* s = text; s < end; ) {
+    const char* const e = statementEnd(s, end);
+    const char* x = skipFiller(s, e);
+    s = e + 1;
+    if( x == e ) {
+      continue;
+    }
+    bad = x;
+    if( nexus ) {
+      if( isWord(x, e, "begin") ) {
+	x = skipFiller(x, e);
+	inTrees = isWord(x, e, "trees");
+	translate = 0;
+	continue;
+      }
+      if( isWord(x, e, "end") || isWord(x, e, "endblock") ) {
+	inTrees = false;
+	continue;
+      }
+      if( ! inTrees ) {
+	continue;
+      }
+      if( isWord(x, e, "translate") ) {
+	tables.push_back(TranslateTable());
+	if( ! readTranslate(x, e, tables.back()) ) {
+	  return false;
+	}
+	translate = &tables.back();
+	continue;
+      }
+      if( ! (isWord(x, e, "tree") || isWord(x, e, "utree")) ) {
+	continue;
+      }
+    }
+    
+    TreeStatement t = {0, e, 0, 0, -1, translate};
+    if( nexus ) {
+      x = skipFiller(x, e);
+      if( x < e && *x == '*' ) {
+	++x;
+      }
+      x = skipFiller(x, e);
+      t.name = x;
+      if( x < e && (*x == '\'' || *x == '"') ) {
+	const char* const q = static_cast<const char*>(memchr(x + 1, *x, e - (x + 1)));
+	x = q ? q + 1 : e;
+      } else {
+	while( x < e && ! isspace(*x) && *x != '=' && *x != '[' ) {
+	  ++x;
+	}
+      }
+      t.nameLen = x - t.name;
+      // comments, including [& ones, may come before the '='
+      while( (x = skipFiller(x, e)) < e && *x == '[' ) {
+	const char* const c = static_cast<const char*>(memchr(x, ']', e - x));
+	x = c ? c + 1 : e;
+      }
+      if( x == e || *x != '=' ) {
+	return false;
+      }
+      ++x;
+    }
+    // tree level comments
+    while( (x = skipFiller(x, e)) < e && *x == '[' ) {
+      const char* const c = static_cast<const char*>(memchr(x, ']', e - x));
+      if( ! c ) {
+	return false;
+      }
+      if( c - x == 3 && (x[2] == 'R' || x[2] == 'r' || x[2] == 'U' || x[2] == 'u') ) {
+	t.rooted = (x[2] == 'R' || x[2] == 'r');
+      }
+      x = c + 1;
+    }
+    t.begin = x;
+    trees.push_back(t);
+  }
+  return true;
 }
 
 template<typename T> class Packer {
@@ -532,12 +738,12 @@ public:
   virtual uint size(void) const = 0;
   
   // Stored values as a vector. Valid until next call to unpacked
-  // from any instantiation
+  // from any instantiation on the same thread
   virtual vector<T> const&  unpacked(void) const = 0;
   
   // Stored values as a vector. Sets isPermanent to false if vector is transient
-  // (becomes invalid on the next call to unpacked from anywhere) and to true if
-  // the return value is safe to keep around.
+  // (becomes invalid on the next call to unpacked from anywhere on the same
+  // thread) and to true if the return value is safe to keep around.
   virtual vector<T> const&  unpacked(bool& isPermanent) const = 0;
 };
 
@@ -569,6 +775,9 @@ private:
 class FixedIntPacker : public Packer<uint> {
 public:
   FixedIntPacker(uint nBitsPerValue, vector<uint>::const_iterator from, vector<uint>::const_iterator to);
+  // View of 'len' values already packed in 'bits' (not owned, say mapped from
+  // a file).
+  FixedIntPacker(uint nBitsPerValue, uint len, const unsigned char* bits);
   virtual ~FixedIntPacker();
 
   vector<uint> const&  unpacked(void) const;
@@ -576,98 +785,93 @@ public:
 
   virtual uint size(void) const { return len; }
 
+  // Packed values and their size in bytes.
+  const unsigned char* packed(void) const { return bits; }
+  static size_t nBytes(uint nBitsPerValue, uint len) {
+    return (static_cast<size_t>(nBitsPerValue) * len + (usize-1)) / usize;
+  }
+
   uint const nBitsPerValue : 8;
   uint const len : 24;
 private:
   static uint const usize = 8*sizeof(char);
-  static vector<uint> temp;
+  // unpacked values, one per thread
+  static vector<uint>& temp(void) {
+    static thread_local vector<uint> t;
+    return t;
+  }
   
-  unsigned char* bits;
+  const unsigned char* bits;
+  bool const ownsBits;
 };
 
 FixedIntPacker::~FixedIntPacker() {
-  delete [] bits;
+  if( ownsBits ) {
+    delete [] bits;
+  }
 }
 
-vector<uint> FixedIntPacker::temp;
+FixedIntPacker::FixedIntPacker(uint _nBitsPerValue, uint _len, const unsigned char* _bits) :
+  nBitsPerValue(_nBitsPerValue),
+  len(_len),
+  bits(_bits),
+  ownsBits(false)
+{}
 
 template<typename T>
 inline T lowerNbits(uint n) {
   return (static_cast<T>(1) << n) - 1;
 }
 
-template<typename T>
-inline T upperNbits(uint n) {
-  return ~lowerNbits<T>(8*sizeof(T)-n);
-}
-
 FixedIntPacker::FixedIntPacker(uint _nBitsPerValue,
 			       vector<uint>::const_iterator from,
 			       vector<uint>::const_iterator to) :
   nBitsPerValue(_nBitsPerValue),
-  len(to-from)
+  len(to-from),
+  ownsBits(true)
 {
-  int const sbits = (nBitsPerValue * len + (usize-1)) / usize;
-  bits = new unsigned char [sbits];
-
-  assert( nBitsPerValue <= usize );
-  if( nBitsPerValue == usize ) {
-    uint k = 0;
-    for(auto v = from; v < to; ++v, ++k) {
-      bits[k] = *v;
-    }
-  } else {
-    
-    std::fill(bits, bits+sbits,0);
-  
-    unsigned char* cur = bits;
-    uint loc = 0;
-  
-    for(auto v = from; v < to; ++v)  {
-      loc += nBitsPerValue;
-      if( loc <= usize ) {
-	*cur |= (*v << (usize - loc));
-      } else {
-	loc -= usize; // now loc is number of bits in next block
-	*cur |= (*v >> loc);
-	++cur;                          assert( cur - bits < sbits );
-	uint const s = usize - loc;
-	*cur |= (*v << s) & ~((1 << s)-1);
-      }
+  int const sbits = nBytes(nBitsPerValue, len);
+  unsigned char* const b = new unsigned char [sbits];
+  bits = b;
+
+  assert( 0 < nBitsPerValue && nBitsPerValue <= 32 );
+  // values one after the other, most significant bit first. 'acc' holds
+  // the bits not yet stored, at most 7 of them between values.
+  unsigned char* cur = b;
+  unsigned long long acc = 0;
+  uint nacc = 0;
+  for(auto v = from; v < to; ++v)  {
+    acc = (acc << nBitsPerValue) | *v;
+    nacc += nBitsPerValue;
+    while( nacc >= usize ) {
+      nacc -= usize;
+      *cur++ = static_cast<unsigned char>(acc >> nacc);
     }
   }
+  if( nacc > 0 ) {
+    *cur++ = static_cast<unsigned char>(acc << (usize - nacc));
+  }
+  assert( cur - b == sbits );
 }
 
 vector<uint> const&
 FixedIntPacker::unpacked(void) const
 {
+  vector<uint>& temp = FixedIntPacker::temp();
   temp.clear();
   temp.resize(len, 0);
-  unsigned char* cur = bits;
+  const unsigned char* cur = bits;
 
-  if( nBitsPerValue == usize ) {
-    for(int k = 0; k < len; ++k) {
-      temp[k] = bits[k];
-    }
-    return temp;
-  }
-  
-  int loc = usize;
-  unsigned char mask = lowerNbits<unsigned char>(nBitsPerValue);
-  
+  unsigned long long const mask = lowerNbits<unsigned long long>(nBitsPerValue);
+  unsigned long long acc = 0;
+  uint nacc = 0;
   for(uint k = 0; k < len; ++k) {
-    loc -= nBitsPerValue;
-    if( loc >= 0 ) {
-      temp[k] = ((*cur) >> loc) & mask;
-    } else {
-      uint const upper = *cur & lowerNbits<unsigned char>(loc + nBitsPerValue);
-      uint const left = -loc;
-
-      ++cur;
-      loc = usize - left;
-      uint const lower = (*cur & upperNbits<unsigned char>(left)) >> loc;
-      temp[k] = (upper << left) | lower;
+    while( nacc < nBitsPerValue ) {
+      acc = (acc << usize) | *cur++;
+      nacc += usize;
     }
+    nacc -= nBitsPerValue;
+    temp[k] = (acc >> nacc) & mask;
   }
   return temp;
 }
@@ -679,6 +883,41 @@ FixedIntPacker::unpacked(bool& isPermanent) const
   return unpacked();
 }
 
+// Values of type T stored contiguously elsewhere (not owned, say mapped from a
+// file).
+template<typename T>
+class MappedPacker : public Packer<T> {
+public:
+  MappedPacker<T>(const char* _vals, uint _len) :
+    vals(_vals),
+    len(_len)
+    {}
+
+  virtual uint size(void) const { return len; }
+
+  vector<T> const&  unpacked(void) const {
+    vector<T>& t = temp();
+    t.resize(len);
+    if( len > 0 ) {
+      memcpy(&t[0], vals, len * sizeof(T));
+    }
+    return t;
+  }
+  
+  vector<T> const&  unpacked(bool& isPermanent) const {
+    isPermanent = false; return unpacked();
+  }
+  
+private:
+  const char* const vals;
+  uint const len;
+  
+  static vector<T>& temp(void) {
+    static thread_local vector<T> t;
+    return t;
+  }
+};
+
 class TreeRep {
 public:
   // steals attributes
@@ -1503,13 +1742,90 @@ public:
 
   // Add a tree from text in NEWICK format.
   int add(const char* txt, PyObject* kwds);
+
+  // Add trees from a NEXUS or NEWICK file, skipping the first 'burnin' trees
+  // (or that fraction of the trees when 'burninFraction' is positive) and
+  // keeping one in every 'thin' of the rest. Trees are parsed and encoded on
+  // 'nThreads' threads. Returns the number of trees added, -1 with a python
+  // error set on failure, in which case no tree is added.
+  int load(const char* fileName, uint burnin, double burninFraction, uint thin,
+	   uint nThreads = 1);
+
+  // Write all trees to 'fileName' in the binary format read by 'open'. Returns
+  // false with a python error set on failure.
+  bool save(const char* fileName) const;
+
+  // A set of the trees in 'fileName' (written by 'save'), mapped into memory
+  // and expanded tree by tree on demand. Returns 0 with a python error set on
+  // failure.
+  static TreesSet* open(const char* fileName);
   
   uint nTrees(void) const { return trees.size(); }
   
   TreeRep const& getTree(uint const i) const {
                                  assert( i < nTrees() );
+    if( ! trees[i] ) {
+      trees[i] = mappedRep(i);
+    }
     return *trees[i];
   }
+
+  // Attributes of tree (new reference), 0 if none. 
+  PyObject* treeAttributes(uint nt) const;
+
+  struct CladeStats {
+    uint	count;
+    // sums of node heights and their squares
+    double	sumHeights;
+    double	sumHeights2;
+    // sums of branches and their squares, over the nBranches non-root nodes
+    double	sumBranches;
+    double	sumBranches2;
+    uint	nBranches;
+  };
+
+  // Clades of all trees, each as a set of taxa (bitset of taxa indices, in
+  // nWords 64 bit words, one after the other in 'clades'), with per-clade
+  // statistics. Single taxon clades are included only when 'withTaxa'. Trees
+  // are split between 'nThreads' threads. Returns nWords. Throws
+  // std::bad_alloc (with the GIL held), as do the summaries built on it.
+  uint cladeCounts(bool withTaxa, uint nThreads, vector<uint64_t>& clades,
+		   vector<CladeStats>& stats) const;
+
+  enum DistanceMetric { robinsonFoulds, weightedRobinsonFoulds, branchScore };
+
+  // All pairwise distances between trees as a condensed matrix (pairs i < j,
+  // row by row) in 'out', which holds nTrees()*(nTrees()-1)/2 values. Clades
+  // (rooted) or splits (unrooted) are compared by a 64 bit hash, computed once
+  // per tree. Trees are split between 'nThreads' threads. Returns false when
+  // out of memory.
+  bool distances(DistanceMetric metric, bool rooted, uint nThreads, double* out) const;
+
+  // Clades (bitsets, as in cladeCounts) of a consensus tree: all clades with
+  // frequency above 'threshold', added from the most frequent down when
+  // compatible with those already in. Majority rule for 0.5, greedy
+  // consensus below it. Tips and root included. 'counts' is the number of trees
+  // with each clade.
+  void consensusClades(double threshold, uint nThreads, vector<uint64_t>& chosen,
+		       vector<uint>& counts) const;
+
+  // Index of the maximum clade credibility tree (largest sum of log clade
+  // frequencies), with its credibility and its clades as in consensusClades.
+  // Throws std::bad_alloc when out of memory, rather than pick from partial
+  // credibilities.
+  uint mccTree(uint nThreads, double& logCredibility, vector<uint64_t>& chosen,
+	       vector<uint>& counts) const;
+
+  enum SummaryHeights { medianHeights, meanHeights, commonAncestorHeights, keepHeights };
+  
+  // NEWICK of the tree of 'chosen' clades (which must be compatible), each
+  // internal node annotated with its posterior and 95% HPD height interval.
+  // Heights are the median or mean height of the clade over trees having it, or
+  // the mean height of the most recent common ancestor of the clade over all
+  // trees, or the heights in tree 'keepTree'. Returns an empty string when out
+  // of memory.
+  string summaryTree(vector<uint64_t> const& chosen, vector<uint> const& counts,
+		     SummaryHeights how, uint keepTree, uint nThreads) const;
   
   // taxon name (existing,string) from internal index.
   string const& taxonString(uint const k) const {
@@ -1517,6 +1833,8 @@ public:
     return taxaList[k];
   }
 
+  uint nTaxa(void) const { return taxaList.size(); }
+  
   // Index of taxon if exists, -1 otherwise
   int hasTaxon(const char* taxon) const;
   
@@ -1531,7 +1849,7 @@ public:
   // floating point precision (float or double)
   uint const precision  : 8;
 
-  vector< vector<ParsedTreeNode> > asNodes;
+  vector<ParsedTree> asNodes;
 
   void add(TreesSet const& ts, uint const nt, vector<uint> const& filteredTaxa);
 
@@ -1542,16 +1860,58 @@ private:
 			vector<double> const&       heights,
 			vector<double>* const       taxaHeights,
 			vector<uint>* const         labels,
-			vector<const Attributes*>*  atrs);
+			vector<const Attributes*>*  atrs) const;
+  
+  // Global taxa indices of tips and labeled internal nodes (inserts new ones).
+  void		resolveTaxa(ParsedTree const& tree, vector<uint>& ids);
+  
+  // Encodes a parsed tree, given its taxa from resolveTaxa. Does not change the
+  // set, so trees may be encoded concurrently.
+  TreeRep*	nodes2rep(ParsedTree& tree, vector<uint> const& ids) const;
+
+  // Add a parsed tree with its attributes (may be 0)
+  int		addParsed(ParsedTree& tree, PyObject* kwds);
+
+  // Add an encoded tree with its attributes (may be 0)
+  int		addRep(TreeRep* r, PyObject* kwds);
+
+  // Drop the trees after the first 'nTrees' and the taxa after the first
+  // 'nTaxa' (undo a failed load).
+  void		truncate(uint nTrees, uint nTaxa);
+
+  // Encoding of the nt'th tree of the mapped file
+  TreeRep*	mappedRep(uint nt) const;
+
+  // Scratch space of scanClades, one per thread.
+  struct CladeScan {
+    // tips of the tree, in tree order
+    vector<uint>	tax;
+    vector<double>	hs;
+    vector<double>	txhs;
+    vector<int>		prevGreater;
+    vector<int>		prevGreaterOrEq;
+    vector<int>		nextGreater;
+  };
+  
+  // Calls f(first, last, height, parentHeight) for each node of the nt'th
+  // tree, whose tips are s.tax[first..last]. Tips are included only when
+  // 'withTaxa'. parentHeight is -1 for the root. Safe to call from several
+  // threads once the tree is expanded.
+  template<typename F>
+  void		scanClades(uint nt, bool withTaxa, CladeScan& s, F const& f) const;
   
-  // Encodes a parsed tree 
-  TreeRep*	nodes2rep(vector<ParsedTreeNode>& nodes);
-
   // taxon index (inserts new ones). 
   uint 		getTaxon(string const& taxon);
 
-  // All trees
-  vector<TreeRep*>		trees;
+  // All trees. Trees of a mapped file are expanded on first access.
+  mutable vector<TreeRep*>	trees;
+
+  // File contents from 'open', with the offset of each tree record. The
+  // first nMapped trees come from the file.
+  const char*			mapped;
+  size_t			mappedSize;
+  const uint64_t*		mappedIndex;
+  uint				nMapped;
 
   vector<PyObject*>		treesAttributes;
   
@@ -1564,7 +1924,11 @@ private:
 TreesSet::TreesSet(bool isCompressed, uint _precision, bool s) :
   compressed(isCompressed),
   store(s),
-  precision(_precision)
+  precision(_precision),
+  mapped(0),
+  mappedSize(0),
+  mappedIndex(0),
+  nMapped(0)
 {}
 
 TreesSet::~TreesSet()
@@ -1576,6 +1940,10 @@ TreesSet::~TreesSet()
   for(auto a = treesAttributes.begin(); a != treesAttributes.end(); ++a) {
     Py_XDECREF(*a);
   }
+
+  if( mapped ) {
+    munmap(const_cast<char*>(mapped), mappedSize);
+  }
 }
 
 int
@@ -1629,10 +1997,11 @@ TreesSet::getHeights(uint nt, vector<double>& hs, vector<double>& txhs) const
 void
 TreesSet::setTreeAttributes(uint nt, TreeObject* to) const
 {
-  PyObject* a = treesAttributes[nt];
-  if( a && PyDict_Size(a) > 0 ) {
+  PyObject* a = treeAttributes(nt);
+  if( a && PyDict_Check(a) && PyDict_Size(a) > 0 ) {
     PyDict_Update(to->dict, a);
   }
+  Py_XDECREF(a);
 }
 
 TreeRep*
@@ -1642,7 +2011,7 @@ TreesSet::repFromData(bool const                  cladogram,
 		      vector<double> const&       heights,
 		      vector<double>* const       taxaHeights,
 		      vector<uint>* const         labels,
-		      vector<const Attributes*>*  atrs)
+		      vector<const Attributes*>*  atrs) const
 {
   Packer<uint>* top = 0;
   
@@ -1695,9 +2064,29 @@ TreesSet::repFromData(bool const                  cladogram,
   return r;
 }
 
+void
+TreesSet::resolveTaxa(ParsedTree const& tree, vector<uint>& ids)
+{
+  vector<ParsedTreeNode> const& nodes = tree.nodes;
+  ids.resize(nodes.size());
+  // all tips first, then internal labels, so taxa are numbered in the same
+  // order however the trees are encoded
+  for(uint k = 0; k < nodes.size(); ++k) {
+    if( nodes[k].sons.size() == 0 ) {
+      ids[k] = getTaxon(nodes[k].taxon.str());
+    }
+  }
+  for(uint k = 0; k < nodes.size(); ++k) {
+    if( nodes[k].sons.size() > 0 && nodes[k].taxon.size() ) {
+      ids[k] = getTaxon(nodes[k].taxon.str());
+    }
+  }
+}
+
 TreeRep*
-TreesSet::nodes2rep(vector<ParsedTreeNode>& nodes)
+TreesSet::nodes2rep(ParsedTree& tree, vector<uint> const& ids) const
 {
+  vector<ParsedTreeNode>& nodes = tree.nodes;
   // tree taxa (as indices into global table)
   vector<uint> taxa;
   bool cladogram = true;
@@ -1708,16 +2097,16 @@ TreesSet::nodes2rep(vector<ParsedTreeNode>& nodes)
   for(auto n = nodes.begin(); n != nodes.end() ; ++n) {
     if( n->sons.size() == 0 ) {
       // can have un-named taxon
-      uint const k = getTaxon(n->taxon);
+      uint const k = ids[n - nodes.begin()];
       maxTaxaIndex = std::max(maxTaxaIndex, k);
       taxa.push_back(k);
     } else if( n->taxon.size() ) {
       hasInternalLabels = true;
     }
-    if( n->branch ) {
+    if( n->hasBranch ) {
       cladogram = false;
     }
-    if( n->attributes ) {
+    if( n->hasAttributes ) {
       hasAttributes = true;
     }
   }
@@ -1738,8 +2127,9 @@ TreesSet::nodes2rep(vector<ParsedTreeNode>& nodes)
   
   for(auto n = nodes.begin(); n != nodes.end() ; ++n) {
     if( n->sons.size() == 0 ) {
-      if( ! n->branch ) {
-	n->branch = new double(1);
+      if( ! n->hasBranch ) {
+	n->branch = 1;
+	n->hasBranch = true;
       }
                                                assert( 0 <= iloc && iloc < locs.size() );
       locs[iloc] = iloc == 0 ? -1 : locs[iloc-1]+1;
@@ -1749,11 +2139,11 @@ TreesSet::nodes2rep(vector<ParsedTreeNode>& nodes)
       double h = -1;
       for(auto s = n->sons.begin(); s != n->sons.end(); ++s) {
 	// After processing the node, we use the branch to store the height.
-	h = std::max(*nodes[*s].branch, h);
+	h = std::max(nodes[*s].branch, h);
       }
       if( ! cladogram ) {
 	for(auto s = n->sons.begin(); s != n->sons.end(); ++s) {
-	  double const h1 = *nodes[*s].branch;
+	  double const h1 = nodes[*s].branch;
 	  double const dh = h - h1;
 	  if( dh > 0 && !areSame(h,h1) ) {
 	    if( ! taxaHeights ) {
@@ -1793,10 +2183,11 @@ TreesSet::nodes2rep(vector<ParsedTreeNode>& nodes)
                                               assert( 0 < iloc && iloc < locs.size() );
       locs[iloc] = locs[iloc-1]; ++iloc;
       // Use the branch to store the node height
-      if( n->branch ) {
-	*n->branch += h;
+      if( n->hasBranch ) {
+	n->branch += h;
       } else if( n+1 != nodes.end() ) {
-	n->branch = new double(h+1);
+	n->branch = h+1;
+	n->hasBranch = true;
       }
     }
   }
@@ -1804,22 +2195,26 @@ TreesSet::nodes2rep(vector<ParsedTreeNode>& nodes)
   vector<const Attributes*>* atrs = 0;
   vector<uint>* labels = 0;
   if( hasAttributes || hasInternalLabels ) {
-    atrs = hasAttributes ? new vector<const Attributes*>(nodes.size(),0) : 0;
+    atrs = hasAttributes ? new vector<const Attributes*>(2*nTaxa-1,0) : 0;
     labels = hasInternalLabels ? new vector<uint>(nTaxa-1, 0) : 0;
 
     for(auto n = nodes.begin(); n != nodes.end() ; ++n) {
       bool const isTip = n->sons.size() == 0;
     
-      if( n->attributes ) {
+      if( n->hasAttributes ) {
 	int const l = isTip ? locs[n - nodes.begin()]+1 : locs[n->sons[0]]+1+nTaxa;
 	assert( atrs->at(l) == 0 );
-	// steal
-	(*atrs)[l] = n->attributes;
-	n->attributes = 0;
+	Attributes* const a = new Attributes;
+	a->reserve(n->atrsEnd - n->atrsBegin);
+	for(uint k = n->atrsBegin; k < n->atrsEnd; ++k) {
+	  auto const& x = tree.attributes[k];
+	  a->push_back(std::pair<string,string>(x.first.str(), x.second.str()));
+	}
+	(*atrs)[l] = a;
       }
       
       if( !isTip && n->taxon.size() ) {
-	uint const k = getTaxon(n->taxon);
+	uint const k = ids[n - nodes.begin()];
 	int const l = locs[n->sons[0]]+1;
 	assert( labels->at(l) == 0 );
 	(*labels)[l] = k+1;
@@ -1839,44 +2234,1531 @@ TreesSet::nodes2rep(vector<ParsedTreeNode>& nodes)
   return r;  
 }
 
-int
-TreesSet::add(const char* treeTxt, PyObject* kwds)
+// Parse a whole tree text, optionally ending with a ';'. On failure 'error'
+// holds the reason. Does not touch python, so safe without the GIL.
+static bool
+parseTreeText(const char* treeTxt, ParsedTree& tree, string& error)
 {
-  vector<ParsedTreeNode> nodes;
-
   int const txtLen = strlen(treeTxt);
-  int nc = readSubTree(treeTxt, nodes);
+  int nc = readSubTree(treeTxt, tree);
 
   if( nc > 0 ) {
     nc += skipSpaces(treeTxt + nc);
   }
   
   if( ! (nc == txtLen || (nc+1 == txtLen && treeTxt[nc] == ';')) ) {
+    char buf[128];
     if( nc < 0) {
       int const where = -(nc+1);
-      PyErr_Format(PyExc_ValueError, "failed parsing around %d (%10.10s ...).", where, treeTxt+where);
+      snprintf(buf, sizeof(buf), "failed parsing around %d (%10.10s ...).", where, treeTxt+where);
+      error = buf;
     } else {
-      PyErr_Format(PyExc_ValueError, "extraneous characters at tree end: '%s'",
-		   string(treeTxt+nc,std::max(5,txtLen-nc)).c_str());
+      error = "extraneous characters at tree end: '" +
+	string(treeTxt+nc,std::max(5,txtLen-nc)) + "'";
     }
-    return -1;
+    return false;
   }
+  return true;
+}
 
-  if( kwds ) {
-    Py_INCREF(kwds);
-  }
-  treesAttributes.push_back(kwds);
+int
+TreesSet::add(const char* treeTxt, PyObject* kwds)
+{
+  ParsedTree tree;
+  string error;
   
-  if( store ) {
-    asNodes.push_back(nodes);
-    return asNodes.size()-1;
-  } else {
-    trees.push_back(nodes2rep(nodes));
-    return trees.size()-1;
+  if( ! parseTreeText(treeTxt, tree, error) ) {
+    PyErr_SetString(PyExc_ValueError, error.c_str());
+    return -1;
   }
+  return addParsed(tree, kwds);
 }
 
-void
+int
+TreesSet::addParsed(ParsedTree& tree, PyObject* kwds)
+{
+  if( store ) {
+    Py_XINCREF(kwds);
+    treesAttributes.push_back(kwds);
+    tree.intern();
+    asNodes.push_back(std::move(tree));
+    return asNodes.size()-1;
+  }
+  vector<uint> ids;
+  resolveTaxa(tree, ids);
+  return addRep(nodes2rep(tree, ids), kwds);
+}
+
+int
+TreesSet::addRep(TreeRep* const r, PyObject* kwds)
+{
+  Py_XINCREF(kwds);
+  treesAttributes.push_back(kwds);
+  trees.push_back(r);
+  return trees.size()-1;
+}
+
+void
+TreesSet::truncate(uint const nTrees, uint const nTaxa)
+{
+  for(uint k = nTrees; k < treesAttributes.size(); ++k) {
+    Py_XDECREF(treesAttributes[k]);
+  }
+  treesAttributes.resize(nTrees);
+  if( store ) {
+    asNodes.erase(asNodes.begin() + nTrees, asNodes.end());
+  } else {
+    for(uint k = nTrees; k < trees.size(); ++k) {
+      delete trees[k];
+    }
+    trees.resize(nTrees);
+  }
+  for(uint k = nTaxa; k < taxaList.size(); ++k) {
+    taxaDict.erase(taxaList[k]);
+  }
+  taxaList.resize(nTaxa);
+}
+
+// Call f(0) ... f(n-1) from 'nThreads' threads, with the GIL released. Returns
+// false when out of memory.
+static bool
+onThreads(uint const nThreads, uint const n, std::function<void(uint)> const& f)
+{
+  std::atomic<uint> next(0);
+  std::atomic<bool> noMemory(false);
+  auto worker = [&]() {
+    try {
+      for(uint i = next++; i < n; i = next++) {
+	f(i);
+      }
+    } catch (std::bad_alloc&) {
+      noMemory = true;
+    }
+  };
+  Py_BEGIN_ALLOW_THREADS
+  {
+    // workers take items as they go, so fewer threads only take longer
+    vector<std::thread> pool;
+    try {
+      pool.reserve(nThreads);
+      for(uint i = 1; i < std::min(nThreads, n); ++i) {
+	pool.push_back(std::thread(worker));
+      }
+    } catch (std::system_error&) {
+    } catch (std::bad_alloc&) {}
+    worker();
+    for(auto t = pool.begin(); t != pool.end(); ++t) {
+      t->join();
+    }
+  }
+  Py_END_ALLOW_THREADS
+  return ! noMemory;
+}
+
+int
+TreesSet::load(const char* fileName, uint burnin, double const burninFraction, uint thin,
+	       uint nThreads)
+{
+  FILE* const f = fopen(fileName, "rb");
+  if( ! f ) {
+    PyErr_SetFromErrnoWithFilename(PyExc_IOError, const_cast<char*>(fileName));
+    return -1;
+  }
+  // whole file, NUL terminated
+  vector<char> text;
+  {
+    char buf[1 << 16];
+    size_t n;
+    while( (n = fread(buf, 1, sizeof(buf), f)) > 0 ) {
+      text.insert(text.end(), buf, buf + n);
+    }
+    bool const failed = ferror(f);
+    fclose(f);
+    if( failed ) {
+      PyErr_SetFromErrnoWithFilename(PyExc_IOError, const_cast<char*>(fileName));
+      return -1;
+    }
+  }
+  text.push_back(0);
+  char* const begin = &text[0];
+  const char* const end = begin + text.size() - 1;
+
+  const char* x = skipFiller(begin, end);
+  bool const nexus = isWord(x, end, "#nexus");
+  
+  list<TranslateTable> tables;
+  vector<TreeStatement> statements;
+  const char* bad = 0;
+  if( ! treeStatements(nexus ? x : begin, end, nexus, tables, statements, bad) ) {
+    PyErr_Format(PyExc_ValueError, "%s: malformed statement at char %d (%20.20s ...).",
+		 fileName, int(bad - begin), bad);
+    return -1;
+  }
+
+  uint const nStatements = statements.size();
+  if( burninFraction > 0 ) {
+    burnin = static_cast<uint>(burninFraction * nStatements);
+  }
+  thin = std::max(thin, 1U);
+
+  vector<uint> selected;
+  for(uint k = burnin; k < nStatements; k += thin) {
+    selected.push_back(k);
+  }
+  uint const nSelected = selected.size();
+  nThreads = std::max(std::min(nThreads, nSelected), 1U);
+
+  // Parse one statement, cut at its ';', and apply its translate table. No
+  // python calls, so runs on any thread.
+  auto parse = [&](TreeStatement const& t, ParsedTree& tree, string& error) {
+    *const_cast<char*>(t.end) = 0;
+    if( ! parseTreeText(t.begin, tree, error) ) {
+      return false;
+    }
+    if( t.translate ) {
+      for(auto n = tree.nodes.begin(); n != tree.nodes.end(); ++n) {
+	if( n->sons.size() == 0 ) {
+	  auto const i = t.translate->find(n->taxon.str());
+	  if( i == t.translate->end() ) {
+	    error = "unable to substitute " + n->taxon.str() + " using 'translate'.";
+	    return false;
+	  }
+	  n->taxon = TextSpan(i->second);
+	}
+      }
+    }
+    return true;
+  };
+
+  // tree name and rooting as tree attributes
+  auto attributes = [](TreeStatement const& t) {
+    PyObject* kwds = 0;
+    if( t.name || t.rooted >= 0 ) {
+      kwds = PyDict_New();
+      if( t.name ) {
+	PyObject* const nm = PyString_FromStringAndSize(t.name, t.nameLen);
+	PyDict_SetItemString(kwds, "name", nm);
+	Py_DECREF(nm);
+      }
+      if( t.rooted >= 0 ) {
+	PyDict_SetItemString(kwds, "rooted", t.rooted ? Py_True : Py_False);
+      }
+    }
+    return kwds;
+  };
+
+  // on failure, drop whatever this load added
+  uint const nTrees0 = store ? asNodes.size() : trees.size();
+  uint const nTaxa0 = taxaList.size();
+  auto failed = [&](string const& error) {
+    truncate(nTrees0, nTaxa0);
+    PyErr_Format(PyExc_ValueError, "%s: %s", fileName, error.c_str());
+    return -1;
+  };
+  
+  if( nThreads == 1 ) {
+    for(uint k = 0; k < nSelected; ++k) {
+      TreeStatement const& t = statements[selected[k]];
+      ParsedTree tree;
+      string error;
+      if( ! parse(t, tree, error) ) {
+	return failed(error);
+      }
+      PyObject* const kwds = attributes(t);
+      addParsed(tree, kwds);
+      Py_XDECREF(kwds);
+    }
+    return nSelected;
+  }
+
+  // Batches of trees in three phases: parse on all threads, then number the
+  // taxa of each tree in file order (the only change to the shared taxa
+  // table, so numbering is as for one thread), then encode on all threads.
+  // Trees are added in file order, and dropped again if a later one fails.
+  struct Parsed {
+    ParsedTree 			tree;
+    vector<uint> 		ids;
+    TreeRep* 			rep;
+    string 			error;
+  };
+  
+  uint const batchSize = 64 * nThreads;
+  vector<Parsed> batch;
+  
+  for(uint b0 = 0; b0 < nSelected; b0 += batchSize) {
+    uint n = std::min(batchSize, nSelected - b0);
+    batch.clear();
+    batch.resize(n);
+    
+    bool ok = onThreads(nThreads, n, [&](uint const i) {
+	Parsed& p = batch[i];
+	p.rep = 0;
+	if( ! parse(statements[selected[b0 + i]], p.tree, p.error) ) {
+	  p.tree.nodes.clear();
+	}
+      });
+    if( ! ok ) {
+      truncate(nTrees0, nTaxa0);
+      PyErr_NoMemory();
+      return -1;
+    }
+
+    uint nGood = 0;
+    while( nGood < n && batch[nGood].error.empty() ) {
+      if( ! store ) {
+	resolveTaxa(batch[nGood].tree, batch[nGood].ids);
+      }
+      ++nGood;
+    }
+
+    if( ! store ) {
+      ok = onThreads(nThreads, nGood, [&](uint const i) {
+	  Parsed& p = batch[i];
+	  p.rep = nodes2rep(p.tree, p.ids);
+	});
+      if( ! ok ) {
+	for(uint i = 0; i < nGood; ++i) {
+	  delete batch[i].rep;
+	}
+	truncate(nTrees0, nTaxa0);
+	PyErr_NoMemory();
+	return -1;
+      }
+    }
+    
+    for(uint i = 0; i < nGood; ++i) {
+      Parsed& p = batch[i];
+      PyObject* const kwds = attributes(statements[selected[b0 + i]]);
+      if( store ) {
+	addParsed(p.tree, kwds);
+      } else {
+	addRep(p.rep, kwds);
+      }
+      Py_XDECREF(kwds);
+    }
+    if( nGood < n ) {
+      return failed(batch[nGood].error);
+    }
+  }
+  return nSelected;
+}
+
+// Binary trees file: header, taxa names, tree records and the offsets of the
+// records. Records and the offsets start on 8 byte boundaries, and numbers are
+// in the byte order of the writer, checked on open. A record is a
+// TreeRecordHeader followed by (each padded to 8 bytes) the marshaled tree
+// attributes, the node attributes, and the packed tips, labels and heights, in
+// the same packing as in memory. Node attributes are a slot count, then per
+// slot the number of attributes plus one (0 for none) followed by
+// length-prefixed names and values.
+
+static char const treesFileMagic[8] = {'T','R','E','E','S','S','E','T'};
+static uint32_t const treesFileVersion = 1;
+static uint32_t const treesFileByteOrder = 0x01020304;
+
+struct TreesFileHeader {
+  char 		magic[8];
+  uint32_t 	version;
+  uint32_t 	byteOrder;
+  uint32_t 	precision;
+  uint32_t 	compressed;
+  uint64_t 	nTaxa;
+  uint64_t 	nTrees;
+  uint64_t 	taxaOffset;
+  uint64_t 	indexOffset;
+};
+
+struct TreeRecordHeader {
+  enum { cladogram = 1, labels = 2, taxaHeights = 4, nodeAttributes = 8 };
+  
+  uint32_t 	nTaxa;
+  uint8_t 	flags;
+  uint8_t 	tipsBits;
+  uint8_t 	labelsBits;
+  uint8_t 	heightsBits;
+  uint32_t 	treeAttributesSize;
+  uint32_t 	nodeAttributesSize;
+};
+
+static inline size_t
+pad8(size_t n)
+{
+  return (n + 7) & ~static_cast<size_t>(7);
+}
+
+static void
+appendBytes(string& buf, const void* p, size_t n)
+{
+  buf.append(static_cast<const char*>(p), n);
+}
+
+static inline uint32_t
+readU32(const char*& p)
+{
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  p += sizeof(v);
+  return v;
+}
+
+// Whether the tree record at 'record', 'size' bytes long up to the next record
+// (or the index), is exactly the sections its header describes, with node
+// attribute strings inside their section, distinct tips and labels among the
+// 'nTaxa' taxa of the file, and heights that are numbers. 'seen' is scratch,
+// 'nTaxa' entries all false.
+static bool
+validRecord(const char* const record, size_t const size, uint const precision,
+	    uint64_t const nTaxa, vector<bool>& seen)
+{
+  TreeRecordHeader h;
+  if( size < sizeof(h) ) {
+    return false;
+  }
+  memcpy(&h, record, sizeof(h));
+  uint const n = h.nTaxa;
+  // packed lengths are 24 bits
+  if( n == 0 || n >= (1U << 24) || (h.flags & ~15) != 0 ) {
+    return false;
+  }
+  
+  size_t need = pad8(sizeof(h)) + pad8(h.treeAttributesSize);
+  
+  if( h.flags & TreeRecordHeader::nodeAttributes ) {
+    if( need + h.nodeAttributesSize > size ) {
+      return false;
+    }
+    const char* a = record + need;
+    const char* const aEnd = a + h.nodeAttributesSize;
+    auto hasU32 = [&a, aEnd]() { return aEnd - a >= 4; };
+    if( ! hasU32() || readU32(a) != 2*n-1 ) {
+      return false;
+    }
+    for(uint k = 0; k < 2*n-1; ++k) {
+      if( ! hasU32() ) {
+	return false;
+      }
+      uint32_t const na = readU32(a);
+      // name and value of each attribute
+      for(uint32_t i = 0; i+1 < na; ++i) {
+	for(uint j = 0; j < 2; ++j) {
+	  if( ! hasU32() ) {
+	    return false;
+	  }
+	  uint32_t const l = readU32(a);
+	  if( l > static_cast<size_t>(aEnd - a) ) {
+	    return false;
+	  }
+	  a += l;
+	}
+      }
+    }
+    if( a != aEnd ) {
+      return false;
+    }
+    need += pad8(h.nodeAttributesSize);
+  } else if( h.nodeAttributesSize != 0 ) {
+    return false;
+  }
+
+  // start of each section
+  size_t const tipsAt = need;
+  size_t labelsAt = 0;
+  size_t heightsAt = 0;
+  
+  auto packed = [&need](uint const nBits, uint const len) {
+    need += pad8(FixedIntPacker::nBytes(nBits, len));
+    return 1 <= nBits && nBits <= 32;
+  };
+  if( ! packed(h.tipsBits, n) ) {
+    return false;
+  }
+  if( h.flags & TreeRecordHeader::labels ) {
+    labelsAt = need;
+    if( ! packed(h.labelsBits, n-1) ) {
+      return false;
+    }
+  }
+  heightsAt = need;
+  if( h.flags & TreeRecordHeader::cladogram ) {
+    if( (h.flags & TreeRecordHeader::taxaHeights) || ! packed(h.heightsBits, n-1) ) {
+      return false;
+    }
+  } else {
+    need += pad8((n-1) * precision);
+    if( h.flags & TreeRecordHeader::taxaHeights ) {
+      need += pad8(n * precision);
+    }
+  }
+  if( need != size ) {
+    return false;
+  }
+
+  auto bits = [record](size_t const at) {
+    return reinterpret_cast<const unsigned char*>(record + at);
+  };
+  
+  vector<uint> const tips(FixedIntPacker(h.tipsBits, n, bits(tipsAt)).unpacked());
+  uint nDistinct = 0;
+  while( nDistinct < n && tips[nDistinct] < nTaxa && ! seen[tips[nDistinct]] ) {
+    seen[tips[nDistinct]] = true;
+    ++nDistinct;
+  }
+  for(uint k = 0; k < nDistinct; ++k) {
+    seen[tips[k]] = false;
+  }
+  if( nDistinct < n ) {
+    return false;
+  }
+  
+  if( labelsAt ) {
+    // taxon + 1, 0 for none
+    vector<uint> const& labels =
+      FixedIntPacker(h.labelsBits, n-1, bits(labelsAt)).unpacked();
+    for(uint k = 0; k+1 < n; ++k) {
+      if( labels[k] > nTaxa ) {
+	return false;
+      }
+    }
+  }
+
+  if( ! (h.flags & TreeRecordHeader::cladogram) ) {
+    auto numbers = [record, precision](size_t const at, uint const len) {
+      for(uint k = 0; k < len; ++k) {
+	double x;
+	if( precision == 8 ) {
+	  memcpy(&x, record + at + k * sizeof(double), sizeof(double));
+	} else {
+	  float f;
+	  memcpy(&f, record + at + k * sizeof(float), sizeof(float));
+	  x = f;
+	}
+	if( std::isnan(x) ) {
+	  return false;
+	}
+      }
+      return true;
+    };
+    // internal heights, then (padded) the tips heights
+    if( ! numbers(heightsAt, n-1) ) {
+      return false;
+    }
+    if( (h.flags & TreeRecordHeader::taxaHeights) &&
+	! numbers(heightsAt + pad8((n-1) * precision), n) ) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool
+TreesSet::save(const char* fileName) const
+{
+  // Written to a new file in the same directory, which then takes the place
+  // of the old one: a set opened from 'fileName' maps the old file, which
+  // must not change under it.
+  string tmpName = string(fileName) + ".XXXXXX";
+  int const fd = mkstemp(&tmpName[0]);
+  FILE* const f = fd >= 0 ? fdopen(fd, "wb") : 0;
+  if( ! f ) {
+    PyErr_SetFromErrnoWithFilename(PyExc_IOError, const_cast<char*>(fileName));
+    if( fd >= 0 ) {
+      close(fd);
+      unlink(tmpName.c_str());
+    }
+    return false;
+  }
+  // permissions of a file made by fopen
+  mode_t const mask = umask(0);
+  umask(mask);
+  fchmod(fd, 0666 & ~mask);
+
+  uint64_t pos = 0;
+  bool ok = true;
+  auto write = [&](const void* p, size_t n) {
+    if( ok && n > 0 && fwrite(p, 1, n, f) != n ) {
+      ok = false;
+    }
+    pos += n;
+  };
+  auto align = [&](void) {
+    static char const zeros[8] = {0};
+    write(zeros, pad8(pos) - pos);
+  };
+  
+  TreesFileHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, treesFileMagic, sizeof(h.magic));
+  h.version = treesFileVersion;
+  h.byteOrder = treesFileByteOrder;
+  h.precision = precision;
+  h.compressed = compressed;
+  h.nTaxa = taxaList.size();
+  h.nTrees = nTrees();
+  write(&h, sizeof(h));
+
+  h.taxaOffset = pos;
+  for(auto t = taxaList.begin(); t != taxaList.end(); ++t) {
+    uint32_t const n = t->size();
+    write(&n, sizeof(n));
+    write(t->c_str(), n);
+  }
+
+  vector<uint64_t> offsets;
+  vector<double> hs;
+  vector<double> txhs;
+  string record;
+
+  for(uint nt = 0; nt < nTrees() && ok; ++nt) {
+    align();
+    offsets.push_back(pos);
+    
+    TreeRep const& rep = getTree(nt);
+    vector<uint> const tips(rep.tips());
+    uint const n = tips.size();
+    
+    TreeRecordHeader r;
+    memset(&r, 0, sizeof(r));
+    r.nTaxa = n;
+    hs.clear();
+    txhs.clear();
+    getHeights(nt, hs, txhs);
+    
+    // tree attributes
+    record.clear();
+    PyObject* const a = treeAttributes(nt);
+    if( a ) {
+      PyObject* const m = PyMarshal_WriteObjectToString(a, Py_MARSHAL_VERSION);
+      Py_DECREF(a);
+      if( ! m ) {
+	fclose(f);
+	unlink(tmpName.c_str());
+	return false;
+      }
+      appendBytes(record, PyString_AS_STRING(m), PyString_GET_SIZE(m));
+      Py_DECREF(m);
+    }
+    r.treeAttributesSize = record.size();
+    record.resize(pad8(record.size()), 0);
+
+    // node attributes
+    auto const atrbs = rep.getAttributes();
+    if( atrbs ) {
+      r.flags |= TreeRecordHeader::nodeAttributes;
+      size_t const start = record.size();
+      uint32_t const nSlots = atrbs->size();
+      appendBytes(record, &nSlots, sizeof(nSlots));
+      for(auto s = atrbs->begin(); s != atrbs->end(); ++s) {
+	uint32_t const na = *s ? (*s)->size() + 1 : 0;
+	appendBytes(record, &na, sizeof(na));
+	if( *s ) {
+	  for(auto x = (*s)->begin(); x != (*s)->end(); ++x) {
+	    uint32_t l = x->first.size();
+	    appendBytes(record, &l, sizeof(l));
+	    record.append(x->first);
+	    l = x->second.size();
+	    appendBytes(record, &l, sizeof(l));
+	    record.append(x->second);
+	  }
+	}
+      }
+      r.nodeAttributesSize = record.size() - start;
+      record.resize(pad8(record.size()), 0);
+    }
+
+    auto appendPacked = [&record](vector<uint> const& v) {
+      uint const nBits = v.size() ? lg2i(*std::max_element(v.begin(), v.end())) + 1 : 1;
+      FixedIntPacker const p(nBits, v.begin(), v.end());
+      appendBytes(record, p.packed(), FixedIntPacker::nBytes(nBits, v.size()));
+      record.resize(pad8(record.size()), 0);
+      return nBits;
+    };
+    
+    r.tipsBits = appendPacked(tips);
+    
+    vector<uint>* const labels = rep.labels();
+    if( labels ) {
+      r.flags |= TreeRecordHeader::labels;
+      r.labelsBits = appendPacked(*labels);
+      delete labels;
+    }
+
+    if( rep.isCladogram() ) {
+      r.flags |= TreeRecordHeader::cladogram;
+      vector<uint> const ihs(hs.begin(), hs.end());
+      r.heightsBits = appendPacked(ihs);
+    } else {
+      if( txhs.size() > 0 ) {
+	r.flags |= TreeRecordHeader::taxaHeights;
+      }
+      for(uint i = 0; i < 2; ++i) {
+	vector<double> const& v = i == 0 ? hs : txhs;
+	if( precision == 8 ) {
+	  appendBytes(record, v.size() ? &v[0] : 0, v.size() * sizeof(double));
+	} else {
+	  vector<float> const fv(v.begin(), v.end());
+	  appendBytes(record, fv.size() ? &fv[0] : 0, fv.size() * sizeof(float));
+	}
+	record.resize(pad8(record.size()), 0);
+      }
+    }
+    
+    write(&r, sizeof(r));
+    align();
+    write(record.data(), record.size());
+  }
+
+  align();
+  h.indexOffset = pos;
+  write(offsets.size() ? &offsets[0] : 0, offsets.size() * sizeof(uint64_t));
+
+  if( ok ) {
+    ok = fseek(f, 0, SEEK_SET) == 0 && fwrite(&h, sizeof(h), 1, f) == 1;
+  }
+  ok = (fclose(f) == 0) && ok;
+  ok = ok && rename(tmpName.c_str(), fileName) == 0;
+  if( ! ok ) {
+    if( ! PyErr_Occurred() ) {
+      PyErr_SetFromErrnoWithFilename(PyExc_IOError, const_cast<char*>(fileName));
+    }
+    unlink(tmpName.c_str());
+    return false;
+  }
+  return true;
+}
+
+TreesSet*
+TreesSet::open(const char* fileName)
+{
+  int const fd = ::open(fileName, O_RDONLY);
+  struct stat st;
+  if( fd < 0 || fstat(fd, &st) != 0 ) {
+    PyErr_SetFromErrnoWithFilename(PyExc_IOError, const_cast<char*>(fileName));
+    if( fd >= 0 ) {
+      close(fd);
+    }
+    return 0;
+  }
+  size_t const size = st.st_size;
+  void* m = size >= sizeof(TreesFileHeader) ?
+    mmap(0, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+  bool const mapFailed = m == MAP_FAILED && size >= sizeof(TreesFileHeader);
+  close(fd);
+  if( mapFailed ) {
+    PyErr_SetFromErrnoWithFilename(PyExc_IOError, const_cast<char*>(fileName));
+    return 0;
+  }
+  
+  const char* const base = static_cast<const char*>(m);
+  auto bad = [=](const char* why) -> TreesSet* {
+    if( base != MAP_FAILED ) {
+      munmap(const_cast<char*>(base), size);
+    }
+    PyErr_Format(PyExc_ValueError, "%s: %s", fileName, why);
+    return 0;
+  };
+  
+  if( base == MAP_FAILED ) {
+    return bad("not a trees set file.");
+  }
+  TreesFileHeader h;
+  memcpy(&h, base, sizeof(h));
+  if( memcmp(h.magic, treesFileMagic, sizeof(h.magic)) != 0 ) {
+    return bad("not a trees set file.");
+  }
+  if( h.byteOrder != treesFileByteOrder ) {
+    return bad("trees set file written on a machine with a different byte order.");
+  }
+  if( h.version != treesFileVersion ) {
+    return bad("unsupported trees set file version.");
+  }
+  if( ! (h.precision == 4 || h.precision == 8) || h.indexOffset % 8 != 0 ||
+      h.indexOffset > size || (size - h.indexOffset) / sizeof(uint64_t) < h.nTrees ) {
+    return bad("corrupt trees set file.");
+  }
+  
+  TreesSet* const ts = new TreesSet(h.compressed, h.precision, false);
+  
+  const char* p = base + h.taxaOffset;
+  const char* const taxaEnd = base + h.indexOffset;
+  for(uint64_t k = 0; k < h.nTaxa; ++k) {
+    if( p + sizeof(uint32_t) > taxaEnd ) {
+      delete ts;
+      return bad("corrupt trees set file.");
+    }
+    uint32_t const n = readU32(p);
+    if( n > static_cast<size_t>(taxaEnd - p) ) {
+      delete ts;
+      return bad("corrupt trees set file.");
+    }
+    ts->getTaxon(string(p, n));
+    p += n;
+  }
+
+  const uint64_t* const index = reinterpret_cast<const uint64_t*>(base + h.indexOffset);
+  vector<bool> seen(h.nTaxa, false);
+  for(uint64_t k = 0; k < h.nTrees; ++k) {
+    // records are written in order, each ending where the next one starts
+    uint64_t const end = k+1 < h.nTrees ? index[k+1] : h.indexOffset;
+    if( index[k] % 8 != 0 || index[k] > end || end > h.indexOffset ||
+	! validRecord(base + index[k], end - index[k], h.precision, h.nTaxa, seen) ) {
+      delete ts;
+      return bad("corrupt trees set file.");
+    }
+  }
+  
+  ts->mapped = base;
+  ts->mappedSize = size;
+  ts->mappedIndex = index;
+  ts->nMapped = h.nTrees;
+  ts->trees.resize(h.nTrees, 0);
+  ts->treesAttributes.resize(h.nTrees, 0);
+  return ts;
+}
+
+TreeRep*
+TreesSet::mappedRep(uint const nt) const
+{
+                                               assert( nt < nMapped );
+  const char* const record = mapped + mappedIndex[nt];
+  TreeRecordHeader h;
+  memcpy(&h, record, sizeof(h));
+  uint const n = h.nTaxa;
+  
+  const char* p = record + pad8(sizeof(h)) + pad8(h.treeAttributesSize);
+
+  vector<const Attributes*>* atrs = 0;
+  if( h.flags & TreeRecordHeader::nodeAttributes ) {
+    const char* a = p;
+    uint32_t const nSlots = readU32(a);
+    atrs = new vector<const Attributes*>(nSlots, 0);
+    for(uint32_t k = 0; k < nSlots; ++k) {
+      uint32_t const na = readU32(a);
+      if( na > 0 ) {
+	Attributes* const atr = new Attributes;
+	for(uint32_t i = 0; i+1 < na; ++i) {
+	  uint32_t l = readU32(a);
+	  string const name(a, l);
+	  a += l;
+	  l = readU32(a);
+	  atr->push_back(std::pair<string,string>(name, string(a, l)));
+	  a += l;
+	}
+	(*atrs)[k] = atr;
+      }
+    }
+    p += pad8(h.nodeAttributesSize);
+  }
+
+  auto packed = [&p](uint const nBits, uint const len) {
+    const unsigned char* const bits = reinterpret_cast<const unsigned char*>(p);
+    p += pad8(FixedIntPacker::nBytes(nBits, len));
+    return new FixedIntPacker(nBits, len, bits);
+  };
+
+  Packer<uint>* const tips = packed(h.tipsBits, n);
+  Packer<uint>* const labels =
+    (h.flags & TreeRecordHeader::labels) ? packed(h.labelsBits, n-1) : 0;
+  
+  if( h.flags & TreeRecordHeader::cladogram ) {
+    return new CladogramRep(*tips, labels, packed(h.heightsBits, n-1), atrs);
+  }
+
+  bool const hasTaxaHeights = h.flags & TreeRecordHeader::taxaHeights;
+  if( precision == 8 ) {
+    auto const hs = new MappedPacker<double>(p, n-1);
+    p += pad8((n-1) * sizeof(double));
+    auto const txhs = hasTaxaHeights ? new MappedPacker<double>(p, n) : 0;
+    return new PhylogramRep<double>(*tips, labels, hs, txhs, atrs);
+  }
+  auto const hs = new MappedPacker<float>(p, n-1);
+  p += pad8((n-1) * sizeof(float));
+  auto const txhs = hasTaxaHeights ? new MappedPacker<float>(p, n) : 0;
+  return new PhylogramRep<float>(*tips, labels, hs, txhs, atrs);
+}
+
+PyObject*
+TreesSet::treeAttributes(uint const nt) const
+{
+  if( nt < nMapped ) {
+    const char* const record = mapped + mappedIndex[nt];
+    TreeRecordHeader h;
+    memcpy(&h, record, sizeof(h));
+    if( h.treeAttributesSize == 0 ) {
+      return 0;
+    }
+    PyObject* const a =
+      PyMarshal_ReadObjectFromString(const_cast<char*>(record + pad8(sizeof(h))),
+				     h.treeAttributesSize);
+    if( ! a ) {
+      PyErr_Clear();
+    }
+    return a;
+  }
+  PyObject* const a = treesAttributes[nt];
+  Py_XINCREF(a);
+  return a;
+}
+
+template<typename F>
+void
+TreesSet::scanClades(uint const nt, bool const withTaxa, CladeScan& s, F const& f) const
+{
+  s.tax = getTree(nt).tips();
+  s.hs.clear();
+  s.txhs.clear();
+  getHeights(nt, s.hs, s.txhs);
+  vector<double> const& hs = s.hs;
+  int const m = hs.size();
+      
+  // As in rep2treeInternal: the node at position i spans the tips between the
+  // nearest higher positions on each side, and runs of equal heights in that
+  // span are one (multifurcating) node.
+  vector<int>& prevGreater = s.prevGreater;
+  vector<int>& prevGreaterOrEq = s.prevGreaterOrEq;
+  vector<int>& nextGreater = s.nextGreater;
+  prevGreater.resize(m);
+  prevGreaterOrEq.resize(m);
+  nextGreater.resize(m);
+  for(int i = 0; i < m; ++i) {
+    int j = i-1;
+    while( j >= 0 && hs[j] < hs[i] ) {
+      j = prevGreaterOrEq[j];
+    }
+    prevGreaterOrEq[i] = j;
+    while( j >= 0 && hs[j] <= hs[i] ) {
+      j = prevGreater[j];
+    }
+    prevGreater[i] = j;
+  }
+  for(int i = m-1; i >= 0; --i) {
+    int j = i+1;
+    while( j < m && hs[j] <= hs[i] ) {
+      j = nextGreater[j];
+    }
+    nextGreater[i] = j;
+  }
+  auto parentHeight = [&](int const lo, int const hi) {
+    double h = -1;
+    if( lo >= 0 ) {
+      h = hs[lo];
+    }
+    if( hi < m && (h < 0 || hs[hi] < h) ) {
+      h = hs[hi];
+    }
+    return h;
+  };
+      
+  for(int i = 0; i < m; ++i) {
+    if( prevGreaterOrEq[i] == prevGreater[i] ) {
+      f(prevGreater[i]+1, nextGreater[i], hs[i], parentHeight(prevGreater[i], nextGreater[i]));
+    }
+  }
+  if( withTaxa ) {
+    for(int t = 0; t <= m; ++t) {
+      f(t, t, s.txhs.size() ? s.txhs[t] : 0.0, parentHeight(t-1, t));
+    }
+  }
+}
+
+uint
+TreesSet::cladeCounts(bool const withTaxa, uint nThreads, vector<uint64_t>& clades,
+		      vector<CladeStats>& stats) const
+{
+  uint const nWords = (taxaList.size() + 63) / 64;
+  uint const nt = nTrees();
+  // expand mapped trees here, not concurrently
+  for(uint k = 0; k < nt; ++k) {
+    getTree(k);
+  }
+  nThreads = std::max(std::min(nThreads, nt), 1U);
+
+  // clade bits (as bytes) to position in stats
+  typedef unordered_map<string,uint> CladeIndex;
+  
+  struct Part {
+    CladeIndex		index;
+    vector<string>	keys;
+    vector<CladeStats>	stats;
+  };
+  vector<Part> parts(nThreads);
+  
+  auto part = [&](uint const p) {
+    Part& part = parts[p];
+    string key;
+    vector<uint64_t> bits(nWords);
+    CladeScan scan;
+    
+    auto add = [&](double const h, double const parentHeight) {
+      key.assign(reinterpret_cast<const char*>(&bits[0]), nWords * sizeof(uint64_t));
+      auto const i = part.index.find(key);
+      uint c;
+      if( i == part.index.end() ) {
+	c = part.stats.size();
+	part.index.insert(std::pair<string,uint>(key, c));
+	part.keys.push_back(key);
+	CladeStats const zero = {0, 0, 0, 0, 0, 0};
+	part.stats.push_back(zero);
+      } else {
+	c = i->second;
+      }
+      CladeStats& st = part.stats[c];
+      st.count += 1;
+      st.sumHeights += h;
+      st.sumHeights2 += h*h;
+      if( parentHeight >= 0 ) {
+	double const b = parentHeight - h;
+	st.sumBranches += b;
+	st.sumBranches2 += b*b;
+	st.nBranches += 1;
+      }
+    };
+    
+    uint const first = (static_cast<unsigned long>(nt) * p) / nThreads;
+    uint const end = (static_cast<unsigned long>(nt) * (p+1)) / nThreads;
+    for(uint k = first; k < end; ++k) {
+      scanClades(k, withTaxa, scan,
+		 [&](int const lo, int const hi, double const h, double const ph) {
+		   std::fill(bits.begin(), bits.end(), 0);
+		   for(int t = lo; t <= hi; ++t) {
+		     uint const x = scan.tax[t];
+		     bits[x / 64] |= static_cast<uint64_t>(1) << (x % 64);
+		   }
+		   add(h, ph);
+		 });
+    }
+  };
+
+  if( ! onThreads(nThreads, nThreads, part) ) {
+    throw std::bad_alloc();
+  }
+
+  // merge into the first part
+  Part& all = parts[0];
+  for(uint p = 1; p < nThreads; ++p) {
+    Part const& part = parts[p];
+    for(uint c = 0; c < part.keys.size(); ++c) {
+      auto const i = all.index.find(part.keys[c]);
+      CladeStats const& s = part.stats[c];
+      if( i == all.index.end() ) {
+	all.index.insert(std::pair<string,uint>(part.keys[c], all.stats.size()));
+	all.keys.push_back(part.keys[c]);
+	all.stats.push_back(s);
+      } else {
+	CladeStats& t = all.stats[i->second];
+	t.count += s.count;
+	t.sumHeights += s.sumHeights;
+	t.sumHeights2 += s.sumHeights2;
+	t.sumBranches += s.sumBranches;
+	t.sumBranches2 += s.sumBranches2;
+	t.nBranches += s.nBranches;
+      }
+    }
+  }
+
+  clades.resize(all.keys.size() * nWords);
+  for(uint c = 0; c < all.keys.size(); ++c) {
+    memcpy(&clades[c * nWords], all.keys[c].data(), nWords * sizeof(uint64_t));
+  }
+  stats.swap(all.stats);
+  return nWords;
+}
+
+// Distance between two trees from their sorted (hash, branch) clades.
+template<TreesSet::DistanceMetric M>
+static double
+splitsDistance(vector< std::pair<uint64_t,double> > const& a,
+	       vector< std::pair<uint64_t,double> > const& b)
+{
+  double d = 0;
+  auto add = [&d](double const x) {
+    if( M == TreesSet::robinsonFoulds ) {
+      d += 1;
+    } else if( M == TreesSet::weightedRobinsonFoulds ) {
+      d += std::fabs(x);
+    } else {
+      d += x*x;
+    }
+  };
+  auto i = a.begin();
+  auto j = b.begin();
+  while( i != a.end() && j != b.end() ) {
+    if( i->first < j->first ) {
+      add(i->second);
+      ++i;
+    } else if( j->first < i->first ) {
+      add(j->second);
+      ++j;
+    } else {
+      if( M != TreesSet::robinsonFoulds ) {
+	add(i->second - j->second);
+      }
+      ++i;
+      ++j;
+    }
+  }
+  for(/**/; i != a.end(); ++i) {
+    add(i->second);
+  }
+  for(/**/; j != b.end(); ++j) {
+    add(j->second);
+  }
+  return M == TreesSet::branchScore ? sqrt(d) : d;
+}
+
+bool
+TreesSet::distances(DistanceMetric const metric, bool const rooted, uint const nThreads,
+		    double* const out) const
+{
+  uint const nt = nTrees();
+  for(uint k = 0; k < nt; ++k) {
+    getTree(k);
+  }
+
+  // a random key per taxon, a clade hash is the xor of the keys of its taxa
+  vector<uint64_t> keys(taxaList.size());
+  uint64_t seed = 0x9e3779b97f4a7c15ULL;
+  for(auto k = keys.begin(); k != keys.end(); ++k) {
+    // splitmix64
+    uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    *k = z ^ (z >> 31);
+  }
+
+  // hash and branch length of each clade (or split) below the root, by hash
+  typedef std::pair<uint64_t,double> Split;
+  vector< vector<Split> > splits(nt);
+
+  bool const ok = onThreads(nThreads, nt, [&](uint const k) {
+      CladeScan scan;
+      vector<Split>& sp = splits[k];
+      // tips are consecutive in a clade, so its hash is the xor of two
+      // prefixes. Unrooted, a split is the side without the first taxon.
+      vector<uint64_t> prefix;
+      int posFirst = -1;
+      scanClades(k, true, scan,
+		 [&](int const lo, int const hi, double const h, double const ph) {
+		   vector<uint> const& tax = scan.tax;
+		   if( prefix.empty() ) {
+		     prefix.resize(tax.size()+1, 0);
+		     for(uint i = 0; i < tax.size(); ++i) {
+		       prefix[i+1] = prefix[i] ^ keys[tax[i]];
+		       if( posFirst < 0 || tax[i] < tax[posFirst] ) {
+			 posFirst = i;
+		       }
+		     }
+		   }
+		   if( ph < 0 ) {
+		     return;
+		   }
+		   uint64_t hash = prefix[hi+1] ^ prefix[lo];
+		   if( ! rooted && lo <= posFirst && posFirst <= hi ) {
+		     hash ^= prefix.back();
+		   }
+		   sp.push_back(Split(hash, ph - h));
+		 });
+      std::sort(sp.begin(), sp.end());
+      // unrooted, both sides of the root are one split
+      uint n = 0;
+      for(uint i = 0; i < sp.size(); ++i) {
+	if( n > 0 && sp[n-1].first == sp[i].first ) {
+	  sp[n-1].second += sp[i].second;
+	} else {
+	  sp[n++] = sp[i];
+	}
+      }
+      sp.resize(n);
+    });
+  if( ! ok ) {
+    return false;
+  }
+
+  // row i holds the pairs (i,j) for j > i
+  return onThreads(nThreads, nt, [&](uint const i) {
+      double* o = out + (static_cast<size_t>(i) * nt - (static_cast<size_t>(i) * (i+1)) / 2);
+      for(uint j = i+1; j < nt; ++j) {
+	switch( metric ) {
+	  case robinsonFoulds:
+	    *o++ = splitsDistance<robinsonFoulds>(splits[i], splits[j]);
+	    break;
+	  case weightedRobinsonFoulds:
+	    *o++ = splitsDistance<weightedRobinsonFoulds>(splits[i], splits[j]);
+	    break;
+	  case branchScore:
+	    *o++ = splitsDistance<branchScore>(splits[i], splits[j]);
+	    break;
+	}
+      }
+    });
+}
+
+// Index of clade bitsets (as bytes), 'nWords' words each.
+static unordered_map<string,uint>
+cladesIndex(vector<uint64_t> const& clades, uint const nWords)
+{
+  unordered_map<string,uint> index;
+  uint const n = nWords ? clades.size() / nWords : 0;
+  for(uint c = 0; c < n; ++c) {
+    index.insert(std::pair<string,uint>
+		 (string(reinterpret_cast<const char*>(&clades[c*nWords]),
+			 nWords * sizeof(uint64_t)), c));
+  }
+  return index;
+}
+
+void
+TreesSet::consensusClades(double const threshold, uint const nThreads,
+			  vector<uint64_t>& chosen, vector<uint>& counts) const
+{
+  vector<uint64_t> clades;
+  vector<CladeStats> stats;
+  uint const nWords = cladeCounts(false, nThreads, clades, stats);
+  uint const nt = nTrees();
+  
+  // most frequent first
+  vector<uint> order;
+  for(uint c = 0; c < stats.size(); ++c) {
+    if( stats[c].count > threshold * nt ) {
+      order.push_back(c);
+    }
+  }
+  std::sort(order.begin(), order.end(), [&](uint const a, uint const b) {
+      if( stats[a].count != stats[b].count ) {
+	return stats[a].count > stats[b].count;
+      }
+      return std::lexicographical_compare(&clades[a*nWords], &clades[(a+1)*nWords],
+					  &clades[b*nWords], &clades[(b+1)*nWords]);
+    });
+
+  chosen.clear();
+  counts.clear();
+  vector<uint64_t> all(nWords, 0);
+  for(uint k = 0; k < taxaList.size(); ++k) {
+    all[k / 64] |= static_cast<uint64_t>(1) << (k % 64);
+  }
+
+  for(auto c = order.begin(); c != order.end(); ++c) {
+    const uint64_t* const x = &clades[*c * nWords];
+    // compatible: disjoint or nested with each clade already in
+    bool ok = true;
+    for(uint i = 0; ok && i < counts.size(); ++i) {
+      const uint64_t* const y = &chosen[i * nWords];
+      bool disjoint = true, xInY = true, yInX = true;
+      for(uint w = 0; w < nWords; ++w) {
+	disjoint = disjoint && (x[w] & y[w]) == 0;
+	xInY = xInY && (x[w] & ~y[w]) == 0;
+	yInX = yInX && (y[w] & ~x[w]) == 0;
+      }
+      ok = disjoint || xInY || yInX;
+    }
+    if( ok ) {
+      chosen.insert(chosen.end(), x, x + nWords);
+      counts.push_back(stats[*c].count);
+    }
+  }
+  
+  bool hasRoot = false;
+  for(uint i = 0; ! hasRoot && i < counts.size(); ++i) {
+    hasRoot = std::equal(all.begin(), all.end(), chosen.begin() + i * nWords);
+  }
+  if( ! hasRoot ) {
+    chosen.insert(chosen.end(), all.begin(), all.end());
+    counts.push_back(0);
+  }
+  // tips are in every tree having them, normally all
+  for(uint k = 0; k < taxaList.size(); ++k) {
+    vector<uint64_t> tip(nWords, 0);
+    tip[k / 64] |= static_cast<uint64_t>(1) << (k % 64);
+    chosen.insert(chosen.end(), tip.begin(), tip.end());
+    counts.push_back(nt);
+  }
+}
+
+uint
+TreesSet::mccTree(uint const nThreads, double& logCredibility,
+		  vector<uint64_t>& chosen, vector<uint>& counts) const
+{
+  vector<uint64_t> clades;
+  vector<CladeStats> stats;
+  uint const nWords = cladeCounts(false, nThreads, clades, stats);
+  uint const nt = nTrees();
+  unordered_map<string,uint> const index = cladesIndex(clades, nWords);
+
+  vector<double> credibility(nt, 0.0);
+  bool const ok = onThreads(nThreads, nt, [&](uint const k) {
+      CladeScan scan;
+      vector<uint64_t> bits(nWords);
+      string key;
+      double cr = 0;
+      scanClades(k, false, scan,
+		 [&](int const lo, int const hi, double, double) {
+		   std::fill(bits.begin(), bits.end(), 0);
+		   for(int t = lo; t <= hi; ++t) {
+		     uint const x = scan.tax[t];
+		     bits[x / 64] |= static_cast<uint64_t>(1) << (x % 64);
+		   }
+		   key.assign(reinterpret_cast<const char*>(&bits[0]), nWords * sizeof(uint64_t));
+		   cr += log(stats[index.find(key)->second].count / double(nt));
+		 });
+      credibility[k] = cr;
+    });
+  if( ! ok ) {
+    throw std::bad_alloc();
+  }
+  
+  uint const best = std::max_element(credibility.begin(), credibility.end()) - credibility.begin();
+  logCredibility = credibility[best];
+
+  chosen.clear();
+  counts.clear();
+  CladeScan scan;
+  scanClades(best, true, scan,
+	     [&](int const lo, int const hi, double, double) {
+	       vector<uint64_t> bits(nWords, 0);
+	       for(int t = lo; t <= hi; ++t) {
+		 uint const x = scan.tax[t];
+		 bits[x / 64] |= static_cast<uint64_t>(1) << (x % 64);
+	       }
+	       string const key(reinterpret_cast<const char*>(&bits[0]), nWords * sizeof(uint64_t));
+	       auto const i = index.find(key);
+	       chosen.insert(chosen.end(), bits.begin(), bits.end());
+	       counts.push_back(i != index.end() ? stats[i->second].count : nt);
+	     });
+  return best;
+}
+
+// Shortest interval holding a 'level' fraction of the (sorted) values, as
+// bayesianStats.hpd. False when too few values.
+static bool
+hpdInterval(vector<double> const& d, double const level, double& lo, double& hi)
+{
+  uint const nIn = static_cast<uint>(level * d.size() + 0.5);
+  if( nIn < 2 ) {
+    return false;
+  }
+  uint i = 0;
+  double r = d[nIn-1] - d[0];
+  for(uint k = 0; k + nIn <= d.size(); ++k) {
+    double const rk = d[k+nIn-1] - d[k];
+    if( rk < r ) {
+      r = rk;
+      i = k;
+    }
+  }
+  lo = d[i];
+  hi = d[i+nIn-1];
+  return true;
+}
+
+static string
+doubleString(double const x)
+{
+  char* const b = PyOS_double_to_string(x, 'r', 0, Py_DTSF_ADD_DOT_0, 0);
+  string const s(b);
+  PyMem_Free(b);
+  return s;
+}
+
+string
+TreesSet::summaryTree(vector<uint64_t> const& chosen, vector<uint> const& counts,
+		      SummaryHeights const how, uint const keepTree, uint const nThreads) const
+{
+  uint const nWords = (taxaList.size() + 63) / 64;
+  uint const nc = counts.size();
+  uint const nt = nTrees();
+  unordered_map<string,uint> const index = cladesIndex(chosen, nWords);
+
+  auto bit = [&](uint const c, uint const x) {
+    return (chosen[c*nWords + x/64] >> (x % 64)) & 1;
+  };
+  
+  // height of each clade in each tree, NaN when not in tree. Common ancestor
+  // heights in 'ca'.
+  double const nan = std::numeric_limits<double>::quiet_NaN();
+  vector<double> heights(static_cast<size_t>(nc) * nt, nan);
+  vector<double> ca(how == commonAncestorHeights ? static_cast<size_t>(nc) * nt : 0);
+  
+  bool const ok = onThreads(nThreads, nt, [&](uint const k) {
+      CladeScan scan;
+      vector<uint64_t> bits(nWords);
+      string key;
+      scanClades(k, true, scan,
+		 [&](int const lo, int const hi, double const h, double) {
+		   std::fill(bits.begin(), bits.end(), 0);
+		   for(int t = lo; t <= hi; ++t) {
+		     uint const x = scan.tax[t];
+		     bits[x / 64] |= static_cast<uint64_t>(1) << (x % 64);
+		   }
+		   key.assign(reinterpret_cast<const char*>(&bits[0]), nWords * sizeof(uint64_t));
+		   auto const i = index.find(key);
+		   if( i != index.end() ) {
+		     heights[static_cast<size_t>(i->second) * nt + k] = h;
+		   }
+		 });
+      if( ca.size() ) {
+	// the common ancestor of tips is the highest node between them
+	vector<int> pos(taxaList.size(), -1);
+	for(uint i = 0; i < scan.tax.size(); ++i) {
+	  pos[scan.tax[i]] = i;
+	}
+	for(uint c = 0; c < nc; ++c) {
+	  // taxa of the clade only, so a tree costs the total size of the clades
+	  int lo = scan.tax.size(), hi = -1;
+	  for(uint w = 0; w < nWords; ++w) {
+	    for(uint64_t b = chosen[c*nWords + w]; b; b &= b-1) {
+	      int const p = pos[64*w + __builtin_ctzll(b)];
+	      if( p >= 0 ) {
+		lo = std::min(lo, p);
+		hi = std::max(hi, p);
+	      }
+	    }
+	  }
+	  double h = nan;
+	  if( lo == hi ) {
+	    h = scan.txhs.size() ? scan.txhs[lo] : 0.0;
+	  } else if( lo < hi ) {
+	    h = *std::max_element(scan.hs.begin() + lo, scan.hs.begin() + hi);
+	  }
+	  ca[static_cast<size_t>(c) * nt + k] = h;
+	}
+      }
+    });
+  if( ! ok ) {
+    return string();
+  }
+
+  vector<double> h(nc, 0.0);
+  vector<double> hpdLow(nc, nan), hpdHigh(nc, nan);
+  vector<double> vals;
+  for(uint c = 0; c < nc; ++c) {
+    vals.clear();
+    for(uint k = 0; k < nt; ++k) {
+      double const x = heights[static_cast<size_t>(c) * nt + k];
+      if( ! std::isnan(x) ) {
+	vals.push_back(x);
+      }
+    }
+    std::sort(vals.begin(), vals.end());
+    hpdInterval(vals, 0.95, hpdLow[c], hpdHigh[c]);
+    
+    switch( how ) {
+      case medianHeights:
+      {
+	uint const n = vals.size();
+	if( n > 0 ) {
+	  h[c] = n % 2 ? vals[n/2] : (vals[n/2 - 1] + vals[n/2]) / 2;
+	}
+	break;
+      }
+      case meanHeights:
+      {
+	if( vals.size() > 0 ) {
+	  double s = 0;
+	  for(auto x = vals.begin(); x != vals.end(); ++x) {
+	    s += *x;
+	  }
+	  h[c] = s / vals.size();
+	}
+	break;
+      }
+      case commonAncestorHeights:
+      {
+	double s = 0;
+	uint n = 0;
+	for(uint k = 0; k < nt; ++k) {
+	  double const x = ca[static_cast<size_t>(c) * nt + k];
+	  if( ! std::isnan(x) ) {
+	    s += x;
+	    n += 1;
+	  }
+	}
+	h[c] = n ? s / n : 0.0;
+	break;
+      }
+      case keepHeights:
+      {
+	double const x = heights[static_cast<size_t>(c) * nt + keepTree];
+	h[c] = std::isnan(x) ? 0.0 : x;
+	break;
+      }
+    }
+  }
+
+  // parent of each clade is the smallest clade containing it
+  vector<uint> size(nc, 0);
+  for(uint c = 0; c < nc; ++c) {
+    for(uint w = 0; w < nWords; ++w) {
+      size[c] += __builtin_popcountll(chosen[c*nWords + w]);
+    }
+  }
+  vector<uint> bySize(nc);
+  for(uint c = 0; c < nc; ++c) {
+    bySize[c] = c;
+  }
+  std::stable_sort(bySize.begin(), bySize.end(),
+		   [&](uint const a, uint const b) { return size[a] > size[b]; });
+  
+  vector<int> parent(nc, -1);
+  vector< vector<uint> > sons(nc);
+  for(uint i = 1; i < nc; ++i) {
+    uint const c = bySize[i];
+    for(uint j = i; j-- > 0; ) {
+      uint const p = bySize[j];
+      bool in = size[p] > size[c];
+      for(uint w = 0; in && w < nWords; ++w) {
+	in = (chosen[c*nWords + w] & ~chosen[p*nWords + w]) == 0;
+      }
+      if( in ) {
+	parent[c] = p;
+	sons[p].push_back(c);
+	break;
+      }
+    }
+  }
+  
+  // a node is at least as high as its sons
+  for(uint i = nc; i-- > 0; ) {
+    uint const c = bySize[i];
+    if( parent[c] >= 0 ) {
+      h[parent[c]] = std::max(h[parent[c]], h[c]);
+    }
+  }
+
+  std::function<string(uint)> newick = [&](uint const c) {
+    string s;
+    if( sons[c].size() == 0 ) {
+      for(uint x = 0; x < taxaList.size(); ++x) {
+	if( bit(c, x) ) {
+	  s = taxaList[x];
+	  break;
+	}
+      }
+    } else {
+      vector<string> subs;
+      for(auto x = sons[c].begin(); x != sons[c].end(); ++x) {
+	subs.push_back(newick(*x));
+      }
+      std::sort(subs.begin(), subs.end());
+      s = "(";
+      for(uint i = 0; i < subs.size(); ++i) {
+	s.append(i ? "," : "").append(subs[i]);
+      }
+      s.append(")[&posterior=").append(doubleString(counts[c] / double(nt)));
+      if( ! std::isnan(hpdLow[c]) ) {
+	s.append(",height_95%_HPD={").append(doubleString(hpdLow[c])).append(",")
+	  .append(doubleString(hpdHigh[c])).append("}");
+      }
+      s.append("]");
+    }
+    if( parent[c] >= 0 ) {
+      s.append(":").append(doubleString(h[parent[c]] - h[c]));
+    }
+    return s;
+  };
+  return newick(bySize[0]);
+}
+
+void
 TreesSet::add(TreesSet const& ts, uint const nt, vector<uint> const& filteredTaxa)
 {
   vector<double> hs;
@@ -1952,9 +3834,7 @@ TreesSet::add(TreesSet const& ts, uint const nt, vector<uint> const& filteredTax
   TreeRep* r = repFromData(rep.isCladogram(), newTips, maxTaxaIndex, newhs,
 			   hasTXheights ? &newtxhs : 0, newLabels, newAtrbs);
   trees.push_back(r);
-  PyObject* a = ts.treesAttributes[nt];
-  Py_XINCREF(a);
-  treesAttributes.push_back(a);
+  treesAttributes.push_back(ts.treeAttributes(nt));
 }
 
 Tree::Expanded::Expanded(int                _itax,
@@ -2183,6 +4063,9 @@ Tree::toNewick(string& s, int nodeId, bool const topoOnly,
 
 struct TreesSetObject : PyObject {
   TreesSet* ts;
+  // Number of calls reading the trees on threads without the GIL, -1 during
+  // a load (see SetUse)
+  int busy;
   
   void del(void);
   void init(void);
@@ -2208,9 +4091,45 @@ void
 TreesSetObject::init(void)
 {
   ts = NULL;
+  busy = 0;
   taxa = new vector<PyObject*>();
 }
 
+// Marks a set in use for the duration of a call. Threaded calls read trees
+// and taxa without the GIL, so another python thread may call in meanwhile:
+// readers may overlap, but a call adding trees (add, load) can not overlap
+// any other, and raises ValueError instead.
+class SetUse {
+public:
+  SetUse(TreesSetObject* _s, bool _write) :
+    s(_s),
+    write(_write),
+    held(write ? s->busy == 0 : s->busy >= 0)
+    {
+      if( ! held ) {
+	PyErr_SetString(PyExc_ValueError, "TreesSet in use by another thread.");
+      } else if( write ) {
+	s->busy = -1;
+      } else {
+	++s->busy;
+      }
+    }
+
+  ~SetUse() {
+    if( held ) {
+      s->busy = write ? 0 : s->busy - 1;
+    }
+  }
+
+  // false, with a python error set, when the set is in use by a conflicting call
+  bool ok(void) const { return held; }
+  
+private:
+  TreesSetObject* const s;
+  bool const		write;
+  bool const		held;
+};
+
 PyObject*
 TreesSetObject::taxon(uint k)
 {
@@ -2287,10 +4206,10 @@ TreesSet_getItemInternals(TreesSetObject* self, uint i)
 {
   auto const& ts = *self->ts;
   if( ts.store ) {
-    auto const& ns = ts.asNodes[i];
-    PyObject* n = PyTuple_New(ns.size());
-    for(uint k = 0; k < ns.size(); ++k) {
-      PyTuple_SET_ITEM(n, k, ns[k].asPyObject());
+    ParsedTree const& tree = ts.asNodes[i];
+    PyObject* n = PyTuple_New(tree.nodes.size());
+    for(uint k = 0; k < tree.nodes.size(); ++k) {
+      PyTuple_SET_ITEM(n, k, tree.nodes[k].asPyObject(tree.attributes));
     }
     return n;
   }
@@ -2329,13 +4248,27 @@ TreesSet_getItemInternals(TreesSetObject* self, uint i)
       
       T const& p = static_cast<T const&>(r);
       PyTuple_SET_ITEM(n, 2, dvector2tuple(p.heights()));
-      PyTuple_SET_ITEM(n, 3, dvector2tuple(*p.txheights()));
+      // no taxa heights when all tips are at 0
+      auto const tx = p.txheights();
+      if( tx ) {
+	PyTuple_SET_ITEM(n, 3, dvector2tuple(*tx));
+      } else {
+	Py_INCREF(Py_None);
+	PyTuple_SET_ITEM(n, 3, Py_None);
+      }
     } else {
       typedef PhylogramRep<double> T;
       
       T const& p = static_cast<T const&>(r);
       PyTuple_SET_ITEM(n, 2, dvector2tuple(p.heights()));
-      PyTuple_SET_ITEM(n, 3, dvector2tuple(*p.txheights()));
+      // no taxa heights when all tips are at 0
+      auto const tx = p.txheights();
+      if( tx ) {
+	PyTuple_SET_ITEM(n, 3, dvector2tuple(*tx));
+      } else {
+	Py_INCREF(Py_None);
+	PyTuple_SET_ITEM(n, 3, Py_None);
+      }
     }
   }
   auto a = r.getAttributes();
@@ -2698,6 +4631,10 @@ treesSet_add(TreesSetObject* self, PyObject* args, PyObject* kwds)
     return 0;
   }
 
+  SetUse const use(self, true);
+  if( ! use.ok() ) {
+    return 0;
+  }
   int const k = self->ts->add(treeTxt, kwds);
   if( k < 0 ) {
     return 0;
@@ -2706,6 +4643,408 @@ treesSet_add(TreesSetObject* self, PyObject* args, PyObject* kwds)
   return PyInt_FromLong(k);
 }
 
+static PyObject*
+treesSet_load(TreesSetObject* self, PyObject* args, PyObject* kwds)
+{
+  static const char *kwlist[] = {"fileName", "burnin", "thin", "nThreads",
+				 static_cast<const char*>(0)};
+  const char* fileName = 0;
+  PyObject* pBurnin = 0;
+  int thin = 1;
+  int nThreads = 0;
+
+  if( !PyArg_ParseTupleAndKeywords(args, kwds, "s|Oii", (char**)kwlist,
+				   &fileName, &pBurnin, &thin, &nThreads) ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args.") ;
+    return 0;
+  }
+
+  // an integer number of trees, or a fraction of all trees in file
+  long burnin = 0;
+  double burninFraction = 0;
+  if( pBurnin ) {
+    if( PyFloat_Check(pBurnin) ) {
+      burninFraction = PyFloat_AsDouble(pBurnin);
+      if( ! (0 <= burninFraction && burninFraction < 1) ) {
+	PyErr_SetString(PyExc_ValueError, "wrong args (burnin fraction not in [0,1)).") ;
+	return 0;
+      }
+    } else {
+      burnin = PyInt_AsLong(pBurnin);
+      if( PyErr_Occurred() || burnin < 0
+	  || static_cast<unsigned long>(burnin) > std::numeric_limits<uint>::max() ) {
+	PyErr_Clear();
+	PyErr_SetString(PyExc_ValueError, "wrong args (burnin).") ;
+	return 0;
+      }
+    }
+  }
+  if( thin <= 0 ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args (thin).") ;
+    return 0;
+  }
+  
+  if( nThreads <= 0 ) {
+    nThreads = std::max(std::thread::hardware_concurrency(), 1U);
+  }
+  
+  SetUse const use(self, true);
+  if( ! use.ok() ) {
+    return 0;
+  }
+  int const n = self->ts->load(fileName, burnin, burninFraction, thin, nThreads);
+  if( n < 0 ) {
+    return 0;
+  }
+  return PyInt_FromLong(n);
+}
+
+static PyObject*
+treesSet_cladeCounts(TreesSetObject* self, PyObject* args, PyObject* kwds)
+{
+  static const char *kwlist[] = {"withTaxa", "withHeights", "nThreads",
+				 static_cast<const char*>(0)};
+  PyObject* pWithTaxa = 0;
+  PyObject* pWithHeights = 0;
+  int nThreads = 0;
+
+  if( !PyArg_ParseTupleAndKeywords(args, kwds, "|OOi", (char**)kwlist,
+				   &pWithTaxa, &pWithHeights, &nThreads) ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args.") ;
+    return 0;
+  }
+
+  TreesSet const& ts = *self->ts;
+  if( ts.store ) {
+    PyErr_SetString(PyExc_ValueError, "Sorry, not implemeted for 'store'.") ;
+    return 0;
+  }
+  
+  bool const withTaxa = pWithTaxa && PyObject_IsTrue(pWithTaxa);
+  bool const withHeights = pWithHeights && PyObject_IsTrue(pWithHeights);
+  if( nThreads <= 0 ) {
+    nThreads = std::max(std::thread::hardware_concurrency(), 1U);
+  }
+  
+  SetUse const use(self, false);
+  if( ! use.ok() ) {
+    return 0;
+  }
+  vector<uint64_t> bits;
+  vector<TreesSet::CladeStats> stats;
+  uint nWords;
+  try {
+    nWords = ts.cladeCounts(withTaxa, nThreads, bits, stats);
+  } catch (std::bad_alloc&) {
+    return PyErr_NoMemory();
+  }
+  uint const nClades = stats.size();
+
+  // clades as sorted taxa indices, most frequent first
+  vector< vector<uint> > clades(nClades);
+  for(uint c = 0; c < nClades; ++c) {
+    for(uint w = 0; w < nWords; ++w) {
+      for(uint64_t b = bits[c*nWords + w]; b; b &= b-1) {
+	clades[c].push_back(64*w + __builtin_ctzll(b));
+      }
+    }
+  }
+  vector<uint> order(nClades);
+  for(uint c = 0; c < nClades; ++c) {
+    order[c] = c;
+  }
+  std::sort(order.begin(), order.end(), [&](uint const a, uint const b) {
+      return stats[a].count != stats[b].count ?
+	stats[a].count > stats[b].count : clades[a] < clades[b];
+    });
+  
+  uint const nTaxa = ts.nTaxa();
+  PyObject* const taxa = PyTuple_New(nTaxa);
+  for(uint k = 0; k < nTaxa; ++k) {
+    PyTuple_SET_ITEM(taxa, k, self->taxon(k));
+  }
+  
+  PyObject* const pClades = PyTuple_New(nClades);
+  PyObject* const counts = PyTuple_New(nClades);
+  PyObject* const pStats = withHeights ? PyTuple_New(nClades) : 0;
+  
+  for(uint i = 0; i < nClades; ++i) {
+    uint const c = order[i];
+    PyTuple_SET_ITEM(pClades, i, ivector2tuple(clades[c]));
+    TreesSet::CladeStats const& st = stats[c];
+    PyTuple_SET_ITEM(counts, i, PyInt_FromLong(st.count));
+    if( pStats ) {
+      // means and standard deviations
+      double const mh = st.sumHeights / st.count;
+      double const sh = sqrt(std::max(st.sumHeights2 / st.count - mh*mh, 0.0));
+      PyObject* o;
+      if( st.nBranches > 0 ) {
+	double const mb = st.sumBranches / st.nBranches;
+	double const sb = sqrt(std::max(st.sumBranches2 / st.nBranches - mb*mb, 0.0));
+	o = Py_BuildValue("(dddd)", mh, sh, mb, sb);
+      } else {
+	o = Py_BuildValue("(ddOO)", mh, sh, Py_None, Py_None);
+      }
+      PyTuple_SET_ITEM(pStats, i, o);
+    }
+  }
+
+  if( pStats ) {
+    return Py_BuildValue("(NNNN)", taxa, pClades, counts, pStats);
+  }
+  return Py_BuildValue("(NNN)", taxa, pClades, counts);
+}
+
+static PyObject*
+treesSet_distances(TreesSetObject* self, PyObject* args, PyObject* kwds)
+{
+  static const char *kwlist[] = {"metric", "rooted", "nThreads", "out",
+				 static_cast<const char*>(0)};
+  const char* pMetric = "rf";
+  PyObject* pRooted = 0;
+  int nThreads = 0;
+  PyObject* out = 0;
+
+  if( !PyArg_ParseTupleAndKeywords(args, kwds, "|sOiO", (char**)kwlist,
+				   &pMetric, &pRooted, &nThreads, &out) ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args.") ;
+    return 0;
+  }
+
+  TreesSet const& ts = *self->ts;
+  if( ts.store ) {
+    PyErr_SetString(PyExc_ValueError, "Sorry, not implemeted for 'store'.") ;
+    return 0;
+  }
+  
+  TreesSet::DistanceMetric metric;
+  if( strcmp(pMetric, "rf") == 0 ) {
+    metric = TreesSet::robinsonFoulds;
+  } else if( strcmp(pMetric, "wrf") == 0 ) {
+    metric = TreesSet::weightedRobinsonFoulds;
+  } else if( strcmp(pMetric, "bs") == 0 ) {
+    metric = TreesSet::branchScore;
+  } else {
+    PyErr_SetString(PyExc_ValueError, "wrong args (metric: rf, wrf or bs).") ;
+    return 0;
+  }
+  bool const rooted = ! pRooted || PyObject_IsTrue(pRooted);
+  if( nThreads <= 0 ) {
+    nThreads = std::max(std::thread::hardware_concurrency(), 1U);
+  }
+
+  // held from here, as creating 'out' may run python code
+  SetUse const use(self, false);
+  if( ! use.ok() ) {
+    return 0;
+  }
+  size_t const nt = ts.nTrees();
+  size_t const n = nt > 1 ? (nt * (nt-1)) / 2 : 0;
+  
+  if( out ) {
+    Py_INCREF(out);
+  } else {
+    PyObject* const numpy = PyImport_ImportModule("numpy");
+    if( ! numpy ) {
+      return 0;
+    }
+    out = PyObject_CallMethod(numpy, const_cast<char*>("zeros"), const_cast<char*>("n"),
+			      static_cast<Py_ssize_t>(n));
+    Py_DECREF(numpy);
+    if( ! out ) {
+      return 0;
+    }
+  }
+
+  // doubles, or plain bytes
+  Py_buffer view;
+  if( PyObject_GetBuffer(out, &view, PyBUF_WRITABLE|PyBUF_FORMAT|PyBUF_C_CONTIGUOUS) < 0 ) {
+    Py_DECREF(out);
+    return 0;
+  }
+  const char* const fmt = view.format ? view.format : "B";
+  bool const isDouble = view.itemsize == sizeof(double) && fmt[strlen(fmt)-1] == 'd';
+  bool const isBytes = view.itemsize == 1 && strchr("Bbc", fmt[0]);
+  if( ! ((isDouble || isBytes) && static_cast<size_t>(view.len) == n * sizeof(double)) ) {
+    PyBuffer_Release(&view);
+    Py_DECREF(out);
+    PyErr_Format(PyExc_ValueError, "wrong args (out: writable buffer of %ld doubles).", long(n));
+    return 0;
+  }
+
+  bool const ok = ts.distances(metric, rooted, nThreads, static_cast<double*>(view.buf));
+  PyBuffer_Release(&view);
+  if( ! ok ) {
+    Py_DECREF(out);
+    return PyErr_NoMemory();
+  }
+  return out;
+}
+
+static bool
+summaryHeights(const char* const pHeights, TreesSet::SummaryHeights& how)
+{
+  if( strcmp(pHeights, "median") == 0 ) {
+    how = TreesSet::medianHeights;
+  } else if( strcmp(pHeights, "mean") == 0 ) {
+    how = TreesSet::meanHeights;
+  } else if( strcmp(pHeights, "ca") == 0 ) {
+    how = TreesSet::commonAncestorHeights;
+  } else if( strcmp(pHeights, "keep") == 0 ) {
+    how = TreesSet::keepHeights;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+static PyObject*
+treesSet_consensus(TreesSetObject* self, PyObject* args, PyObject* kwds)
+{
+  static const char *kwlist[] = {"threshold", "heights", "nThreads",
+				 static_cast<const char*>(0)};
+  double threshold = 0.5;
+  const char* pHeights = "median";
+  int nThreads = 0;
+
+  if( !PyArg_ParseTupleAndKeywords(args, kwds, "|dsi", (char**)kwlist,
+				   &threshold, &pHeights, &nThreads) ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args.") ;
+    return 0;
+  }
+
+  TreesSet const& ts = *self->ts;
+  if( ts.store ) {
+    PyErr_SetString(PyExc_ValueError, "Sorry, not implemeted for 'store'.") ;
+    return 0;
+  }
+  
+  TreesSet::SummaryHeights how;
+  if( ! summaryHeights(pHeights, how) || how == TreesSet::keepHeights ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args (heights: median, mean or ca).") ;
+    return 0;
+  }
+  if( ts.nTrees() == 0 ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args (no trees).") ;
+    return 0;
+  }
+  if( nThreads <= 0 ) {
+    nThreads = std::max(std::thread::hardware_concurrency(), 1U);
+  }
+
+  SetUse const use(self, false);
+  if( ! use.ok() ) {
+    return 0;
+  }
+  vector<uint64_t> clades;
+  vector<uint> counts;
+  try {
+    ts.consensusClades(threshold, nThreads, clades, counts);
+  } catch (std::bad_alloc&) {
+    return PyErr_NoMemory();
+  }
+  string const tree = ts.summaryTree(clades, counts, how, 0, nThreads);
+  if( tree.size() == 0 ) {
+    return PyErr_NoMemory();
+  }
+  return PyString_FromStringAndSize(tree.c_str(), tree.size());
+}
+
+static PyObject*
+treesSet_mcc(TreesSetObject* self, PyObject* args, PyObject* kwds)
+{
+  static const char *kwlist[] = {"heights", "nThreads",
+				 static_cast<const char*>(0)};
+  const char* pHeights = "keep";
+  int nThreads = 0;
+
+  if( !PyArg_ParseTupleAndKeywords(args, kwds, "|si", (char**)kwlist,
+				   &pHeights, &nThreads) ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args.") ;
+    return 0;
+  }
+
+  TreesSet const& ts = *self->ts;
+  if( ts.store ) {
+    PyErr_SetString(PyExc_ValueError, "Sorry, not implemeted for 'store'.") ;
+    return 0;
+  }
+  
+  TreesSet::SummaryHeights how;
+  if( ! summaryHeights(pHeights, how) ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args (heights: keep, median, mean or ca).") ;
+    return 0;
+  }
+  if( ts.nTrees() == 0 ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args (no trees).") ;
+    return 0;
+  }
+  if( nThreads <= 0 ) {
+    nThreads = std::max(std::thread::hardware_concurrency(), 1U);
+  }
+
+  SetUse const use(self, false);
+  if( ! use.ok() ) {
+    return 0;
+  }
+  vector<uint64_t> clades;
+  vector<uint> counts;
+  double logCredibility;
+  uint best;
+  try {
+    best = ts.mccTree(nThreads, logCredibility, clades, counts);
+  } catch (std::bad_alloc&) {
+    return PyErr_NoMemory();
+  }
+  string const tree = ts.summaryTree(clades, counts, how, best, nThreads);
+  if( tree.size() == 0 ) {
+    return PyErr_NoMemory();
+  }
+  return Py_BuildValue("(ids#)", int(best), logCredibility, tree.c_str(),
+		       int(tree.size()));
+}
+
+static PyObject*
+treesSet_save(TreesSetObject* self, PyObject* args)
+{
+  const char* fileName = 0;
+  if( !PyArg_ParseTuple(args, "s", &fileName) ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args.") ;
+    return 0;
+  }
+
+  if( self->ts->store ) {
+    PyErr_SetString(PyExc_ValueError, "Sorry, not implemeted for 'store'.") ;
+    return 0;
+  }
+
+  if( ! self->ts->save(fileName) ) {
+    return 0;
+  }
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject*
+treesSet_open(PyObject* type, PyObject* args)
+{
+  const char* fileName = 0;
+  if( !PyArg_ParseTuple(args, "s", &fileName) ) {
+    PyErr_SetString(PyExc_ValueError, "wrong args.") ;
+    return 0;
+  }
+
+  TreesSet* const ts = TreesSet::open(fileName);
+  if( ! ts ) {
+    return 0;
+  }
+  
+  TreesSetObject* const n =
+    static_cast<TreesSetObject *>(TreesSet_new(reinterpret_cast<PyTypeObject*>(type), 0, 0));
+  n->ts = ts;
+  return n;
+}
+
 // static PyObject*
 // treesSet_dat(TreesSetObject* self)
 // {
@@ -2746,7 +5085,66 @@ treesSet_add(TreesSetObject* self, PyObject* args, PyObject* kwds)
 
 static PyMethodDef treesSet_methods[] = {
   {"add", (PyCFunction)treesSet_add, METH_VARARGS|METH_KEYWORDS,
-   "Add a tree to set."
+   "Add a tree to set. Raises ValueError while another thread runs a threaded"
+   " method (load, cladeCounts, distances, consensus, mcc) on the set."
+  },
+
+  {"load", (PyCFunction)treesSet_load, METH_VARARGS|METH_KEYWORDS,
+   "Add trees from a NEXUS (trees block, with translate tables) or NEWICK file."
+   " burnin skips that number of trees (or that fraction of the trees in the file"
+   " when a float), and thin keeps one in every thin of the rest. Trees are parsed"
+   " on nThreads threads (default all cores), same result as a single thread."
+   " Returns the number of trees added. On error no tree is added. The set is not"
+   " to be used by other python threads meanwhile: add, load and the threaded"
+   " methods raise ValueError."
+  },
+
+  {"cladeCounts", (PyCFunction)treesSet_cladeCounts, METH_VARARGS|METH_KEYWORDS,
+   "Clades of all trees and the number of trees having each, as (taxa, clades,"
+   " counts). A clade is a sorted tuple of indices into taxa, most frequent clades"
+   " first. Single taxon clades are included with withTaxa. withHeights adds a"
+   " tuple of (mean height, sd height, mean branch, sd branch) per clade, branches"
+   " None for a clade which is always the root. Trees are split between nThreads"
+   " threads (default all cores), which run without the interpreter lock; trees"
+   " can not be added (add, load) meanwhile."
+  },
+
+  {"distances", (PyCFunction)treesSet_distances, METH_VARARGS|METH_KEYWORDS,
+   "Distances between all pairs of trees, as a condensed matrix (pairs i < j, row"
+   " by row, as in scipy pdist). metric is 'rf' (Robinson-Foulds: number of clades"
+   " in only one tree), 'wrf' (weighted RF: sum of absolute branch differences) or"
+   " 'bs' (branch score). Clades are rooted, or unrooted splits when rooted is"
+   " false. The result is written into out, a writable buffer of doubles (or"
+   " bytes) of the right size, or a new numpy array. Trees are split between"
+   " nThreads threads (default all cores), as in cladeCounts."
+  },
+
+  {"consensus", (PyCFunction)treesSet_consensus, METH_VARARGS|METH_KEYWORDS,
+   "Consensus tree (NEWICK) of clades with frequency above threshold, added from"
+   " the most frequent down when compatible with those already in: majority rule"
+   " for 0.5 (the default), greedy consensus below it. Node heights are the 'median'"
+   " or 'mean' height of the clade in trees having it, or 'ca' - the mean height"
+   " of the common ancestor of its taxa in all trees. Internal nodes are"
+   " annotated with posterior and height_95%_HPD. Trees are split between nThreads"
+   " threads (default all cores), as in cladeCounts."
+  },
+
+  {"mcc", (PyCFunction)treesSet_mcc, METH_VARARGS|METH_KEYWORDS,
+   "Maximum clade credibility tree, as (index, log credibility, NEWICK). The"
+   " credibility of a tree is the product of the frequencies of its clades. Node"
+   " heights are from the tree itself ('keep', the default), or as in consensus"
+   " ('median', 'mean' or 'ca'), and nodes are annotated as in consensus. Trees are"
+   " split between nThreads threads (default all cores), as in cladeCounts."
+  },
+
+  {"save", (PyCFunction)treesSet_save, METH_VARARGS,
+   "Write trees to a binary file, to be read back with TreesSet.open."
+  },
+
+  {"open", (PyCFunction)treesSet_open, METH_VARARGS|METH_CLASS,
+   "A TreesSet of the trees in a file written by save. The file is mapped into"
+   " memory (and shared between processes), and trees are expanded only when"
+   " accessed. Trees added later are kept in memory."
   },
 
   {"filterTaxa", (PyCFunction)treesSet_filterTaxa, METH_VARARGS,
@@ -2820,10 +5218,10 @@ parseTree(PyObject*, PyObject* args)
     return 0;
   }
 
-  vector<ParsedTreeNode> nodes;
+  ParsedTree tree;
 
   int const txtLen = strlen(treeTxt);
-  int nc = readSubTree(treeTxt, nodes);
+  int nc = readSubTree(treeTxt, tree);
 
   if( nc > 0 ) {
     nc += skipSpaces(treeTxt + nc);
@@ -2840,9 +5238,9 @@ parseTree(PyObject*, PyObject* args)
     return 0;
   }
 
-  PyObject* n = PyTuple_New(nodes.size());
-  for(uint k = 0; k < nodes.size(); ++k) {
-    PyTuple_SET_ITEM(n, k, nodes[k].asPyObject());
+  PyObject* n = PyTuple_New(tree.nodes.size());
+  for(uint k = 0; k < tree.nodes.size(); ++k) {
+    PyTuple_SET_ITEM(n, k, tree.nodes[k].asPyObject(tree.attributes));
   }
   return n;
 }
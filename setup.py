@@ -10,11 +10,13 @@ module2 = Extension('biopy.cnexus',
 
 module3 = Extension('biopy.treesset',
                     sources = ['biopy/treesset.cc'],
-                    extra_compile_args=['-std=c++0x', '-Wno-invalid-offsetof'])
+                    extra_compile_args=['-std=c++0x', '-Wno-invalid-offsetof', '-pthread'],
+                    extra_link_args=['-pthread'])
 
 module4 = Extension('biopy.neutralsim',
                     sources = ['biopy/neutralsim.cc'],
-                    extra_compile_args=['-std=c++0x'])
+                    extra_compile_args=['-std=c++0x', '-pthread'],
+                    extra_link_args=['-pthread'])
 
 module5 = Extension('biopy.calign',
                     sources = ['biopy/calign.cc'],
@@ -0,0 +1,84 @@
+#! /usr/bin/env python
+## This file is part of biopy.
+## See the files gpl.txt and lgpl.txt for copying conditions.
+#
+# Events per second of neutralsim forward simulation over a fixed matrix of
+# settings. Each setting runs in its own process, so the memory high-water
+# mark is of that setting alone. Prints one JSON object per line.
+#
+#   python tests/neutralsimBench.py > bench.json
+#   python tests/neutralsimBench.py --quick --repeat 3
+
+from __future__ import division
+
+import argparse, sys, os, json, subprocess, resource, platform
+from time import time
+
+import neutralsim
+
+# (nPlots, plotSize, mu, lam, rho, traced, simulation time)
+settings = [
+  (4,    100, 1, 0.01,  0.05, False, 2000),
+  (4,    100, 1, 0.01,  0.05, True,  2000),
+  (16,   500, 1, 0.001, 0.1,  False, 200),
+  (16,   500, 1, 0.001, 0.1,  True,  200),
+  (100,  100, 1, 0.01,  0.5,  False, 200),
+  (100,  100, 1, 0.01,  0.5,  True,  200),
+  (1,  10000, 1, 0.001, 0,    False, 50),
+  (1,  10000, 1, 0.001, 0,    True,  50),
+  ]
+
+quickSettings = [
+  (4, 100, 1, 0.01, 0.05, False, 20),
+  (4, 100, 1, 0.01, 0.05, True,  20),
+  ]
+
+def runOne(setting, seed) :
+  nPlots, plotSize, mu, lam, rho, traced, simTime = setting
+  c = neutralsim.newCommunity(nPlots=nPlots, plotSize=plotSize, trace=traced, seed=seed)
+  start = time()
+  # includes converting the final community to python, small next to the run
+  neutralsim.forwardSimulation(c, simTime, mu, lam, rho)
+  elapsed = time() - start
+  events, nodes, peakNodes, cleanUpTime, nCleanUps = neutralsim.runStats(c)
+  # kilobytes on linux, bytes on mac
+  rss = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+  if platform.system() == 'Darwin' :
+    rss //= 1024
+  return dict(nPlots = nPlots, plotSize = plotSize, mu = mu, lam = lam, rho = rho,
+              traced = traced, time = simTime, seed = seed,
+              events = events, seconds = elapsed,
+              eventsPerSecond = events / elapsed if elapsed > 0 else None,
+              traceNodes = nodes, peakTraceNodes = peakNodes,
+              cleanUpSeconds = cleanUpTime, cleanUps = nCleanUps,
+              maxRSSkb = rss)
+
+parser = argparse.ArgumentParser(description="""Benchmark neutralsim forward
+simulation. One JSON object per line for each setting and repeat.""")
+
+parser.add_argument("--quick", action="store_true", default = False,
+                    help="Small settings only, as a smoke test.")
+
+parser.add_argument("--repeat", type = int, default = 1,
+                    help="Runs of each setting, with seeds 1,2,... (default %(default)d)")
+
+parser.add_argument("--one", metavar="N,SEED", default = None,
+                    help=argparse.SUPPRESS)
+
+options = parser.parse_args()
+
+if options.one is not None :
+  n, seed = [int(x) for x in options.one.split(',')]
+  allSettings = quickSettings if options.quick else settings
+  print json.dumps(runOne(allSettings[n], seed), sort_keys = True)
+  sys.exit(0)
+
+allSettings = quickSettings if options.quick else settings
+for n in range(len(allSettings)) :
+  for seed in range(1, options.repeat+1) :
+    args = [sys.executable, os.path.abspath(__file__), "--one", "%d,%d" % (n,seed)]
+    if options.quick :
+      args.append("--quick")
+    out = subprocess.check_output(args)
+    sys.stdout.write(out)
+    sys.stdout.flush()
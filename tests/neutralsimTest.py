@@ -0,0 +1,424 @@
+import neutralsim
+
+def batchTest() :
+  """
+>>> r = neutralsim.forwardSimBatch(4, 3, 20, 5.0, 1, 0.01, 0.05, seed=7)
+>>> len(r)
+4
+>>> [len(c) for t,c in r]
+[3, 3, 3, 3]
+>>> all(t >= 5.0 for t,c in r)
+True
+
+# Independent of the number of threads
+>>> r1 = neutralsim.forwardSimBatch(4, 3, 20, 5.0, 1, 0.01, 0.05, seed=7, nThreads=1)
+>>> r == r1
+True
+
+# Replicates differ from each other
+>>> r[0] == r[1]
+False
+
+>>> r = neutralsim.forwardSimBatch(2, 3, 20, 5.0, 1, 0.01, 0.05, seed=7, trace=True)
+>>> [len(c) for t,c in r]
+[2, 2]
+"""
+  pass
+
+def threadsTest() :
+  """
+# Plots split between two threads, reproducible for the same number of threads
+>>> c0 = neutralsim.newCommunity(nPlots=4, plotSize=20, seed=2)
+>>> c1 = neutralsim.newCommunity(nPlots=4, plotSize=20, seed=2)
+>>> r = neutralsim.forwardSimulation(c0, 5, 1, 0.01, 0.1, nThreads=2, epoch=0.05)
+>>> r == neutralsim.forwardSimulation(c1, 5, 1, 0.01, 0.1, nThreads=2, epoch=0.05)
+True
+>>> r[0], len(r[1]), len(r[1][3])
+(5.0, 4, 20)
+
+# Draws one by one from the community streams when asked to
+>>> c0 = neutralsim.newCommunity(nPlots=4, plotSize=20, seed=2)
+>>> c1 = neutralsim.newCommunity(nPlots=4, plotSize=20, seed=2)
+>>> r1 = neutralsim.forwardSimulation(c0, 5, 1, 0.01, 0.1, nThreads=2, epoch=0.05,
+...                                   batchRandom=False)
+>>> r1 == neutralsim.forwardSimulation(c1, 5, 1, 0.01, 0.1, nThreads=2, epoch=0.05,
+...                                    batchRandom=False)
+True
+>>> r1 == r
+False
+
+>>> c = neutralsim.newCommunity(nPlots=4, plotSize=20)
+>>> neutralsim.forwardSimulation(c, 1e20, 1, 0.01, 0.1, nThreads=2, epoch=1)
+Traceback (most recent call last):
+  ...
+ValueError: wrong args: epoch too small for the simulation times
+
+# Other calls on a community raise while its threads run
+>>> import threading
+>>> c = neutralsim.newCommunity(nPlots=4, plotSize=500, seed=3)
+>>> stop = threading.Event()
+>>> def run() :
+...   t = 0
+...   while not stop.is_set() :
+...     t = neutralsim.forwardSimulation(c, t + 1, 1, 0.01, 0.1, nThreads=2)[0]
+>>> th = threading.Thread(target=run)
+>>> th.start()
+>>> while True :
+...   try :
+...     x = neutralsim.speciesInfo(c)
+...   except ValueError, e :
+...     break
+>>> stop.set()
+>>> th.join()
+>>> str(e), neutralsim.speciesInfo(c)[0] > 0
+('community in use by another thread.', True)
+
+>>> c = neutralsim.newCommunity(nPlots=4, plotSize=20, trace=True)
+>>> neutralsim.forwardSimulation(c, 5, 1, 0.01, 0.1, nThreads=2)
+Traceback (most recent call last):
+  ...
+ValueError: wrong args: threads only for untraced communities without samples
+"""
+  pass
+
+def dispersalTest() :
+  """
+# Immigrants only from the plot itself: plots keep their own species
+>>> com = [[p+1]*20 for p in range(3)]
+>>> c = neutralsim.newCommunity(metaCommunity=com, seed=5)
+>>> d = [[1,0,0], [0,1,0], [0,0,1]]
+>>> t, r = neutralsim.forwardSimulation(c, 10, 1, 0, 0.5, dispersal=d)
+>>> [set(x) for x in r]
+[set([1]), set([2]), set([3])]
+
+# Kernel truncated before the nearest neighbour
+>>> c = neutralsim.newCommunity(metaCommunity=com, seed=5)
+>>> pos = [(0,0), (0,1), (5,5)]
+>>> t, r = neutralsim.forwardSimulation(c, 10, 1, 0, 0.5, positions=pos, kernelCutoff=0.5)
+>>> [set(x) for x in r]
+[set([1]), set([2]), set([3])]
+
+# Plot 0 receives from plot 1 only
+>>> c = neutralsim.newCommunity(metaCommunity=com, seed=5)
+>>> d = [[0,1,0], [0,1,0], [0,0,1]]
+>>> t, r = neutralsim.forwardSimulation(c, 10, 1, 0, 1, dispersal=d)
+>>> [set(x) for x in r]
+[set([2]), set([2]), set([3])]
+
+>>> neutralsim.forwardSimulation(c, 10, 1, 0, 1, dispersal=[[1,0]])
+Traceback (most recent call last):
+  ...
+ValueError: wrong args: dispersal not a nPlots x nPlots matrix with a positive weight in each row
+"""
+  pass
+
+def coalescenceTest() :
+  """
+>>> c = neutralsim.newCommunity(nPlots=3, plotSize=20, trace=True, seed=3)
+>>> t, (com, traces) = neutralsim.forwardSimulation(c, 20, 1, 0.02, 0.1)
+>>> state = neutralsim.getRandomState(c)
+>>> counts = neutralsim.CAcounts(c, 50, 50)
+>>> neutralsim.setRandomState(c, state)
+>>> counts == neutralsim.CAcounts(c, 50, 50, index=True)
+True
+
+>>> m = neutralsim.coalescenceTimes(c, [(0,0), (0,1), (2,5)])
+>>> [m[i][i] == traces[p][k][0] for i,(p,k) in enumerate([(0,0), (0,1), (2,5)])]
+[True, True, True]
+>>> m[0][1] == m[1][0] and m[0][1] <= min(m[0][0], m[1][1])
+True
+>>> m == neutralsim.coalescenceTimes(c, [[0,0], [0,1], [2,5]])
+True
+>>> neutralsim.coalescenceTimes(c, [(0,0,1)])
+Traceback (most recent call last):
+  ...
+ValueError: wrong args: sample not a sequence of (plot, individual)
+
+>>> c = neutralsim.newCommunity(nPlots=2, plotSize=3, trace=True)
+>>> neutralsim.coalescenceTimes(c, [(0,0), (1,2)])
+((0.0, -1.0), (-1.0, 0.0))
+"""
+  pass
+
+def speciesTest() :
+  """
+>>> for recycle in (False, True) :
+...   c = neutralsim.newCommunity(nPlots=4, plotSize=50, seed=2, recycleSpecies=recycle)
+...   t, com = neutralsim.forwardSimulation(c, 300, 1, 0.05, 0.1)
+...   flat = sum(com, ())
+...   nLive, maxLive, last = neutralsim.speciesInfo(c)
+...   print (nLive, maxLive) == (len(set(flat)), max(flat)), last > 2 * nLive
+True True
+True False
+"""
+  pass
+
+def genealogyTest() :
+  """
+>>> import array
+>>> c = neutralsim.newCommunity(nPlots=3, plotSize=8, trace=True, seed=7)
+>>> t, (com, traces) = neutralsim.forwardSimulation(c, 15, 1, 0.05, 0.2)
+>>> g = neutralsim.genealogy(c)
+>>> [x.format for x in g]
+['i', 'd', 'i', 'i', 'I', 'I']
+>>> g = [array.array(x.format, x.tobytes()) for x in g]
+>>> parents, times, plots, patches, species, leaves = g
+>>> len(leaves), parents[0], all(parents[k] < k for k in range(1, len(parents)))
+(24, -1, True)
+>>> all(times[parents[k]] <= times[k] for k in range(1, len(parents)))
+True
+>>> v = neutralsim.speciesView(c).tobytes()
+>>> array.array('I', v) == array.array('I', [species[x] for x in leaves])
+True
+
+# Only the founder has no plot, whatever the start time
+>>> c1 = neutralsim.newCommunity(nPlots=2, plotSize=5, trace=True, startTime=-50, seed=7)
+>>> t, r = neutralsim.forwardSimulation(c1, -45, 1, 0.05, 0.2)
+>>> g1 = neutralsim.genealogy(c1)
+>>> times, plots = array.array('d', g1[1].tobytes()), array.array('i', g1[2].tobytes())
+>>> [k for k in range(len(plots)) if plots[k] < 0], all(x < 0 for x in times)
+([0], True)
+>>> (g1[1].strides, g1[2].strides) == ((8,), (4,))
+True
+
+>>> tree = neutralsim.genealogyNewick(c)
+>>> tree.count('_'), tree.count('('), tree[-1]
+(24, 23, ';')
+"""
+  pass
+
+def runStatsTest() :
+  """
+>>> c = neutralsim.newCommunity(nPlots=2, plotSize=50, trace=True, seed=3)
+>>> r = neutralsim.forwardSimulation(c, 10, 1, 0.01, 0.1)
+>>> events, nodes, peak, seconds, nCleanUps = neutralsim.runStats(c)
+>>> 800 < events < 1200, nodes <= peak, nCleanUps > 0
+(True, True, True)
+>>> c = neutralsim.newCommunity(nPlots=2, plotSize=50, seed=3)
+>>> r = neutralsim.forwardSimulation(c, 10, 1, 0.01, 0.1, nThreads=2)
+>>> neutralsim.runStats(c)[0] > 800, neutralsim.runStats(c)[1:]
+(True, (0, 0, 0.0, 0L))
+"""
+  pass
+
+def optTracesTest() :
+  """
+# Same compaction with any number of threads, genealogy unchanged
+>>> import tempfile, os
+>>> fd, name = tempfile.mkstemp()
+>>> os.close(fd)
+>>> c = neutralsim.newCommunity(nPlots=4, plotSize=30, trace=True, seed=6)
+>>> r = neutralsim.forwardSimulation(c, 50, 1, 0.02, 0.1, cleanEvery=1000)
+>>> neutralsim.saveCommunity(c, name)
+>>> d = neutralsim.loadCommunity(name)
+>>> os.remove(name)
+>>> tree = neutralsim.genealogyNewick(c)
+>>> neutralsim.optTraces(c, nThreads=1)
+>>> neutralsim.optTraces(d, nThreads=3)
+>>> neutralsim.runStats(c)[1] == neutralsim.runStats(d)[1] < neutralsim.runStats(c)[2]
+True
+>>> neutralsim.genealogyNewick(d) == tree
+True
+"""
+  pass
+
+def leapTest() :
+  """
+>>> c = neutralsim.newCommunity(nPlots=3, plotSize=200, seed=8)
+>>> t, com, (steps, events, maxReplaced, clipped) = neutralsim.forwardSimulation(c, 10, 1, 0.01, 0.1, leap=0.1)
+>>> t, [len(p) for p in com], steps
+(10.0, [200, 200, 200], 100)
+>>> 5000 < events < 7000 and maxReplaced < 0.2
+True
+>>> nLive, maxLive, last = neutralsim.speciesInfo(c)
+>>> nLive == len(set(sum(com, ()))), maxLive == max(sum(com, ()))
+(True, True)
+
+# Steps end at sample times
+>>> c = neutralsim.newCommunity(nPlots=3, plotSize=200, seed=8)
+>>> t, r, d = neutralsim.forwardSimulation(c, 10, 1, 0.01, 0.1, leap=0.3, stats=True, sampleTimes=[2.5])
+>>> [x[0] for x in r], d[0]
+([2.5, 10.0], 35)
+
+>>> c = neutralsim.newCommunity(nPlots=3, plotSize=200, trace=True)
+>>> neutralsim.forwardSimulation(c, 10, 1, 0.01, 0.1, leap=0.1)
+Traceback (most recent call last):
+  ...
+ValueError: wrong args: leaping only for untraced communities in a single thread
+
+>>> c = neutralsim.newCommunity(nPlots=3, plotSize=200)
+>>> neutralsim.forwardSimulation(c, 10, 1, 0.01, 0.1, leap=0.1, batchRandom=False)
+Traceback (most recent call last):
+  ...
+ValueError: wrong args: batchRandom, minCAtime and cleanEvery do not apply to leaping
+"""
+  pass
+
+def randomStateTest() :
+  """
+>>> c0 = neutralsim.newCommunity(nPlots=3, plotSize=20, seed=11)
+>>> c1 = neutralsim.newCommunity(nPlots=3, plotSize=20, seed=11)
+>>> neutralsim.getRandomState(c0) == neutralsim.getRandomState(c1)
+True
+>>> r0 = neutralsim.forwardSimulation(c0, 5, 1, 0.01, 0.05)
+>>> r0 == neutralsim.forwardSimulation(c1, 5, 1, 0.01, 0.05)
+True
+
+# Different streams of the same seed
+>>> c2 = neutralsim.newCommunity(nPlots=3, plotSize=20, seed=11, stream=1)
+>>> neutralsim.getRandomState(c0) == neutralsim.getRandomState(c2)
+False
+
+# Save and restore community with its random state
+>>> t, com = neutralsim.forwardSimulation(c0, 10, 1, 0.01, 0.05)
+>>> state = neutralsim.getRandomState(c0)
+>>> c3 = neutralsim.newCommunity(metaCommunity = com, startTime = t, randomState = state)
+>>> r0 = neutralsim.forwardSimulation(c0, 15, 1, 0.01, 0.05)
+>>> r0 == neutralsim.forwardSimulation(c3, 15, 1, 0.01, 0.05)
+True
+
+# Events drawn one by one from the community stream
+>>> c4 = neutralsim.newCommunity(metaCommunity = com, startTime = t, randomState = state)
+>>> c5 = neutralsim.newCommunity(metaCommunity = com, startTime = t, randomState = state)
+>>> r4 = neutralsim.forwardSimulation(c4, 15, 1, 0.01, 0.05, batchRandom=False)
+>>> r4 == neutralsim.forwardSimulation(c5, 15, 1, 0.01, 0.05, batchRandom=False)
+True
+>>> r4 == r0
+False
+>>> neutralsim.setRandomState(c3, state)
+>>> neutralsim.getRandomState(c3) == state
+True
+"""
+  pass
+
+def speciesViewTest() :
+  """
+>>> import struct
+>>> c = neutralsim.newCommunity(nPlots=2, plotSize=3, seed=1)
+>>> t, com = neutralsim.forwardSimulation(c, 3, 1, 0.2, 0.2)
+>>> v = neutralsim.speciesView(c)
+>>> v.shape, v.format, v.readonly
+((2L, 3L), 'I', True)
+>>> struct.unpack('6I', v.tobytes()) == com[0] + com[1]
+True
+"""
+  pass
+
+def minCAtimeTest() :
+  """
+# Stop as soon as all individuals coalesce after time 5
+>>> c = neutralsim.newCommunity(nPlots=2, plotSize=10, trace=True, seed=3)
+>>> t, (com, traces) = neutralsim.forwardSimulation(c, 1000, 1, 0.05, 0.2, minCAtime=5)
+>>> t < 1000
+True
+>>> def root(x) :
+...   while x[3] is not None : x = x[3]
+...   return x
+>>> roots = set(root(x) for p in traces for x in p)
+>>> len(roots)
+1
+>>> roots.pop()[0] > 5
+True
+"""
+  pass
+
+def backwardTest() :
+  """
+>>> g = neutralsim.backwardSimulation(4, 50, 1, 0.01, 0.1, [3,0,2,1], seed=5)
+>>> parents, ages, plots, species = g
+>>> len(parents)
+11
+>>> plots[:6]
+(0, 0, 0, 2, 2, 3)
+>>> parents[-1], parents[:-1].count(-1)
+(-1, 0)
+>>> all(ages[p] >= ages[k] for k,p in enumerate(parents) if p >= 0)
+True
+
+# no speciation: a single species
+>>> g = neutralsim.backwardSimulation(4, 50, 1, 0, 0.1, 2, seed=5)
+>>> set(g[3])
+set([1])
+
+# same species identity probabilities, within a plot and between plots, as
+# a forward simulation run to equilibrium
+>>> g = [neutralsim.backwardSimulation(2, 20, 1, 0.05, 0.2, [2,1], seed=s)[3] for s in range(2000)]
+>>> bw, bb = [sum(x[0] == x[k] for x in g) / 2000.0 for k in (1,2)]
+>>> fw = fb = 0.0
+>>> for s in range(400) :
+...   c = neutralsim.newCommunity(nPlots=2, plotSize=20, seed=s)
+...   t, (p0, p1) = neutralsim.forwardSimulation(c, 400, 1, 0.05, 0.2)
+...   fw += sum(p0[i] == p0[j] for i in range(20) for j in range(i)) / 190.0 / 400
+...   fb += sum(x == y for x in p0 for y in p1) / 400.0 / 400
+>>> abs(bw - fw) < 0.04, abs(bb - fb) < 0.04
+(True, True)
+"""
+  pass
+
+def checkpointTest() :
+  """
+>>> import tempfile, os
+>>> fd, name = tempfile.mkstemp()
+>>> os.close(fd)
+>>> for trace in (False, True) :
+...   c = neutralsim.newCommunity(nPlots=3, plotSize=30, trace=trace, seed=4)
+...   r = neutralsim.forwardSimulation(c, 20, 1, 0.02, 0.1)
+...   neutralsim.saveCommunity(c, name)
+...   d = neutralsim.loadCommunity(name)
+...   r = neutralsim.forwardSimulation(c, 60, 1, 0.02, 0.1)
+...   print r == neutralsim.forwardSimulation(d, 60, 1, 0.02, 0.1)
+True
+True
+>>> open(name, 'w').write('junk')
+>>> neutralsim.loadCommunity(name)
+Traceback (most recent call last):
+  ...
+ValueError: not a valid community checkpoint.
+>>> os.remove(name)
+"""
+  pass
+
+def statsTest() :
+  """
+>>> c = neutralsim.newCommunity(nPlots=2, plotSize=50, seed=4)
+>>> t, r = neutralsim.forwardSimulation(c, 30, 1, 0.02, 0.1, stats=True, sampleTimes=[20,10])
+>>> [int(x[0]) for x in r]
+[10, 20, 30]
+>>> t, plots, whole = r[-1]
+>>> len(plots)
+2
+>>> nSpecies, shannon, simpson, octaves = plots[0]
+>>> sum(octaves) == nSpecies
+True
+>>> 0 < simpson < 1 and shannon > 0
+True
+
+# Species of all individuals at each sample time, in one buffer. Same
+# summaries as computed from the species at the last sample.
+>>> import array
+>>> c = neutralsim.newCommunity(nPlots=2, plotSize=50, seed=4)
+>>> t, b = neutralsim.forwardSimulation(c, 30, 1, 0.02, 0.1, snapshots=True, sampleTimes=[10,20])
+>>> a = array.array('I')
+>>> a.fromstring(b)
+>>> len(a)
+300
+>>> [len(set(a[200+50*k:250+50*k])) for k in (0,1)] == [p[0] for p in plots]
+True
+>>> len(set(a[200:300])) == whole[0]
+True
+
+# Stopped by minCAtime: the last summary is of the community at the end
+>>> c = neutralsim.newCommunity(nPlots=2, plotSize=20, trace=True, seed=3)
+>>> t, r = neutralsim.forwardSimulation(c, 1e6, 1, .01, .1, minCAtime=1, stats=True, sampleTimes=[5])
+>>> t < 1e6, [x[0] for x in r] == [5, t]
+(True, True)
+>>> c = neutralsim.newCommunity(nPlots=2, plotSize=20, trace=True, seed=3)
+>>> t1, (com, traces) = neutralsim.forwardSimulation(c, 1e6, 1, .01, .1, minCAtime=1)
+>>> t1 == t, [len(set(p)) for p in com] == [p[0] for p in r[-1][1]]
+(True, True)
+"""
+  pass
+
+if __name__ == '__main__':
+  import doctest
+  doctest.testmod()
@@ -127,6 +127,15 @@ def basicAttributesTest() :
 >>> tree0txt = '(a[&a=1,x=2],b)'; i0 = ts.add(tree0txt)
 >>> ts[i0].toNewick(attributes=1)
 '(a[&a=1,x=2],b)'
+>>> tree0txt = '(a:[c]1[& a ="1,2",x={3,4}],b:2)lab [&ab=1]'; i0 = ts.add(tree0txt)
+>>> ts[i0].toNewick(attributes=1)
+'(a[&a=1,2,x=3,4]:1.0,b:2.0)lab[&ab=1]'
+
+# store keeps the parsed nodes, after the text is gone
+>>> ts = treesset.TreesSet(store=True)
+>>> i0 = ts.add('(a:1,b[&x=y]:2)lab[&ab=1]')
+>>> ts.treei(i0)
+(['a', 1.0, None, None], ['b', 2.0, None, {'x': 'y'}], ['lab', None, [0L, 1L], {'ab': '1'}])
 """
   pass
 
@@ -209,6 +218,200 @@ def basicLabelsFilterTest() :
 '(a,b[&b=1])[&abc=1]'
 """
   pass
+def loadTest() :
+  """
+>>> import tempfile, os
+>>> fd, name = tempfile.mkstemp()
+>>> f = os.fdopen(fd, 'w')
+>>> f.write("#NEXUS\\n[a comment; with a semicolon]\\nBegin trees;\\n")
+>>> f.write("  Translate 1 a, 2 b, 3 'c d';\\n")
+>>> f.write("tree STATE_0 [&lnP=-1.5] = [&R] ((1:1[&rate=0.5],2:1):1,3:2);\\n")
+>>> f.write("tree STATE_1 = [&R] ((1:1,3:1):0.5,2:1.5);\\n")
+>>> f.write("tree STATE_2 = [&U] (1:1,(2:1,3:1):1);\\nEnd;\\n")
+>>> f.close()
+>>> ts = treesset.TreesSet()
+>>> ts.load(name)
+3
+>>> ts[0].toNewick(attributes=1)
+"('c d':2.0,(a[&rate=0.5]:1.0,b:1.0):1.0)"
+>>> [(t.name, t.rooted) for t in ts]
+[('STATE_0', True), ('STATE_1', True), ('STATE_2', False)]
+
+# any number of threads, same trees and taxa numbering
+>>> ts1 = treesset.TreesSet()
+>>> ts1.load(name, nThreads=1), ts1.load(name, nThreads=4)
+(3, 3)
+>>> [ts.treei(k) for k in range(3)] == [ts1.treei(k) for k in range(3, 6)]
+True
+
+# burnin as number of trees or fraction, then thinning
+>>> ts = treesset.TreesSet()
+>>> ts.load(name, burnin=1), [t.name for t in ts]
+(2, ['STATE_1', 'STATE_2'])
+>>> ts = treesset.TreesSet()
+>>> ts.load(name, burnin=0.5), ts.load(name, thin=2), [t.name for t in ts]
+(2, 2, ['STATE_1', 'STATE_2', 'STATE_0', 'STATE_2'])
+
+# plain NEWICK, one tree per statement
+>>> open(name, 'w').write('((a:1,b:1):1,c:2);\\n(a,(b,c));\\n')
+>>> ts = treesset.TreesSet()
+>>> ts.load(name), [str(t) for t in ts]
+(2, ['((a:1.0,b:1.0):1.0,c:2.0)', '((b,c),a)'])
+
+# a bad tree fails the whole load, trees and taxa before it are dropped
+>>> open(name, 'w').write('((a,b),z);\\n(a,(b,c);\\n')
+>>> for n in (1, 4) :
+...   try :
+...     ts.load(name, nThreads=n)
+...   except ValueError :
+...     print len(ts), ts.cladeCounts(withTaxa=1)[0]
+2 ('a', 'b', 'c')
+2 ('a', 'b', 'c')
+>>> ts.load(name, burnin=2**32)
+Traceback (most recent call last):
+  ...
+ValueError: wrong args (burnin).
+>>> os.remove(name)
+"""
+  pass
+
+def saveOpenTest() :
+  """
+>>> import tempfile, os
+>>> fd, name = tempfile.mkstemp()
+>>> os.close(fd)
+>>> ts = treesset.TreesSet()
+>>> ts.add("((a:1[&x=1],b:2)lab:1[&s={1,2}],c:3)", name='t0')
+0
+>>> ts.add("((a,b),(c,d))")
+1
+>>> ts.save(name)
+>>> o = treesset.TreesSet.open(name)
+>>> len(o), o[0].name, o[0].toNewick(attributes=1), str(o[1])
+(2, 't0', '((a[&x=1]:1.0,b:2.0)lab[&s=1,2]:1.0,c:3.0)', '((a,b),(c,d))')
+>>> o.treei(0) == ts.treei(0), o.treei(1) == ts.treei(1)
+(True, True)
+
+# trees added to an opened set stay in memory, and are saved with the others
+>>> o.add("(a:1,e:1)")
+2
+>>> o.save(name)
+>>> [str(t) for t in treesset.TreesSet.open(name)]
+['((a:1.0,b:2.0)lab:1.0,c:3.0)', '((a,b),(c,d))', '(a:1.0,e:1.0)']
+
+# saving over the file a set was opened from, with trees well past the first
+# pages of the file, leaves the opened set intact
+>>> ts = treesset.TreesSet()
+>>> for k in range(3000) :
+...   i = ts.add("(((a:%d,b:1):1,(c:1,d:2):2):1,(e:1,f:%d):3)" % (k+1, k+2))
+>>> ts.save(name)
+>>> os.path.getsize(name) > 100000
+True
+>>> o = treesset.TreesSet.open(name)
+>>> o.save(name)
+>>> str(o[2999]) == str(ts[2999])
+True
+>>> r = treesset.TreesSet.open(name)
+>>> len(r), all(str(r[k]) == str(ts[k]) for k in range(len(ts)))
+(3000, True)
+
+# records are checked on open: a tree record claiming one more taxon
+>>> import struct
+>>> ts = treesset.TreesSet()
+>>> ts.add("((a,b),(c,d))"), ts.save(name)
+(0, None)
+>>> data = bytearray(open(name, 'rb').read())
+>>> indexOffset, = struct.unpack_from('Q', data, 48)
+>>> record, = struct.unpack_from('Q', data, indexOffset)
+>>> struct.pack_into('I', data, record, 5)
+>>> open(name, 'wb').write(data)
+>>> try :
+...   treesset.TreesSet.open(name)
+... except ValueError as e :
+...   print str(e) == name + ': corrupt trees set file.'
+True
+>>> os.remove(name), [x for x in os.listdir(os.path.dirname(name))
+...                     if x.startswith(os.path.basename(name))]
+(None, [])
+"""
+  pass
+
+def cladeCountsTest() :
+  """
+>>> ts = treesset.TreesSet()
+>>> for t in ["((a:1,b:1):1,c:2)", "((a:2,b:2):1,c:3)", "(a:1,(b:0.5,c:0.5):0.5)"] :
+...   k = ts.add(t)
+>>> taxa, clades, counts = ts.cladeCounts()
+>>> taxa, clades, counts
+(('a', 'b', 'c'), ((0, 1, 2), (0, 1), (1, 2)), (3, 2, 1))
+>>> taxa, clades, counts, stats = ts.cladeCounts(withHeights=True, withTaxa=True, nThreads=2)
+>>> r = lambda s : tuple(x if x is None else round(x, 3) for x in s)
+>>> for c,n,s in zip(clades, counts, stats) :
+...   print [taxa[i] for i in c], n, r(s)
+['a'] 3 (0.0, 0.0, 1.333, 0.471)
+['a', 'b', 'c'] 3 (2.0, 0.816, None, None)
+['b'] 3 (0.0, 0.0, 1.167, 0.624)
+['c'] 3 (0.0, 0.0, 1.833, 1.027)
+['a', 'b'] 2 (1.5, 0.5, 1.0, 0.0)
+['b', 'c'] 1 (0.5, 0.0, 0.5, 0.0)
+
+# trees can not be added while another thread counts them
+>>> import threading
+>>> for k in range(20000) :
+...   i = ts.add("(((a:1,b:1):1,(c:1,d:2):2):1,(e:1,f:%d):3)" % (k+2))
+>>> stop = threading.Event()
+>>> def count() :
+...   while not stop.is_set() :
+...     c = ts.cladeCounts(nThreads=2)
+>>> th = threading.Thread(target=count)
+>>> th.start()
+>>> while True :
+...   try :
+...     i = ts.add("(a,b)")
+...   except ValueError, e :
+...     break
+>>> stop.set()
+>>> th.join()
+>>> str(e), ts.add("(a,b)") == len(ts) - 1
+('TreesSet in use by another thread.', True)
+"""
+  pass
+
+def distancesTest() :
+  """
+>>> import array
+>>> ts = treesset.TreesSet()
+>>> for t in ["((a:1,b:1):1,c:2)", "((a:2,b:2):1,c:3)", "(a:1,(b:0.5,c:0.5):0.5)"] :
+...   k = ts.add(t)
+>>> out = bytearray(8 * 3)
+>>> for m in ['rf', 'wrf', 'bs'] :
+...   print m, array.array('d', str(ts.distances(metric=m, out=out))).tolist()
+rf [0.0, 2.0, 2.0]
+wrf [3.0, 3.5, 6.5]
+bs [1.7320508075688772, 1.9364916731037085, 3.278719262151]
+
+# unrooted, the split ab|c is trivial
+>>> array.array('d', str(ts.distances(rooted=False, out=out))).tolist()
+[0.0, 0.0, 0.0]
+"""
+  pass
+
+def consensusTest() :
+  """
+>>> ts = treesset.TreesSet()
+>>> for t in ["((a:1,b:1):2,(c:2,d:2):1)", "((a:2,b:2):1,(c:1,d:1):2)",
+...           "((a:1,c:1):2,(b:2,d:2):1)", "(((a:1,b:1):1,c:2):1,d:3)"] :
+...   k = ts.add(t)
+>>> print ts.consensus()
+((a:1.0,b:1.0)[&posterior=0.75,height_95%_HPD={1.0,2.0}]:2.0,c:3.0,d:3.0)[&posterior=1.0,height_95%_HPD={3.0,3.0}]
+>>> print ts.consensus(threshold=0, heights="ca")
+((a:1.75,b:1.75)[&posterior=0.75,height_95%_HPD={1.0,2.0}]:1.25,(c:2.25,d:2.25)[&posterior=0.5,height_95%_HPD={1.0,2.0}]:0.75)[&posterior=1.0,height_95%_HPD={3.0,3.0}]
+>>> i, cr, t = ts.mcc()
+>>> print i, round(cr, 6), t
+0 -0.980829 ((a:1.0,b:1.0)[&posterior=0.75,height_95%_HPD={1.0,2.0}]:2.0,(c:2.0,d:2.0)[&posterior=0.5,height_95%_HPD={1.0,2.0}]:1.0)[&posterior=1.0,height_95%_HPD={3.0,3.0}]
+"""
+  pass
+
 ## ((((((10:0.036162075000000016,9:0.036162075000000016):0.06274895000000003,1:0.09891103000000001):0.026505180000000017,((13:0.014917999999999987,14:0.014917999999999987):0.03569254299999991,15:0.050610541999999814):0.07480567000000016):0.26405415,(4:0.032545126999999896,5:0.032545126999999896):0.3569252500000002):0.2710403200000002,7:0.6605106600000004):0.2432706699999998,(((16:0.024232836,6:0.024232836):0.009055312000000003,8:0.033288147):0.12789393999999998,3:0.16118209):2.3345778,((12:0.2212771,2:0.2212771):0.20966916000000002,11:0.43094626):0.47283506)
 
 if __name__ == '__main__':